@@ -1,20 +1,29 @@
+#define _FILE_OFFSET_BITS 64 // off_t Ϊ 64 λ̿Գ 2 GB
 #include <stdio.h>
 #include "string.h"
 #include "stdlib.h"
 #include "time.h"
-#include <sys/ioctl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h> //  STDIN_FILENO
 
 // ļϵͳغ궨
-#define blocks 4611            // ܿ (1+1+1+512+4096)
-#define blocksiz 512           // ÿС (ֽ)
 #define inodesiz 64            // ڵС (ֽ)
-#define data_begin_block 515   // ݿʼ
 #define dirsiz 32              // Ŀ¼ (ֽ)
 #define EXT2_NAME_LEN 15       // ļ󳤶
+#ifndef PATH                   // ׼Եȳڰļǰָ
 #define PATH "MY_DISK"           // ļ·
+#endif
+#define READ_CHUNK (64 * blocksiz) // ȡʱÿζȡֽ
+#define COPY_CHUNK (1 << 20)   // 뵼ʱÿΰ˵ֽ
+#define WRITE_BUFFER (1 << 20) // Write ڴлֽʱȷ鲢д
 
 // ṹ壬ļϵͳϢռ 68 ֽ
 typedef struct ext2_group_desc {
@@ -26,7 +35,15 @@ typedef struct ext2_group_desc {
     int bg_free_inodes_count; // ڿڵ
     int bg_used_dirs_count;   // Ŀ¼
     char password[16];             // ļϵͳ
-    char bg_pad[36];          //  
+    int bg_magic;             // EXT2_GD_MAGIC ʾֶЧ (ɸʽĴΪ 0)
+    int bg_journal_block;     // ־ʼ (Կ)
+    int bg_journal_blocks;    // ־
+    int bg_block_size;        // С (Ϊ 0 ʱǾɸʽ 512 ֽڿ顢)
+    int bg_groups;            // 
+    int bg_inodes_per_group;  // ÿõڵ
+    int bg_flags;             // ״̬־ (EXT2_BG_*ɸʽĴΪ 0)
+    int bg_itable_unused;     // ڵĩβδڵ (EXT2_BG_ITABLE_UNINIT ʱЧ)
+    char bg_pad[4];           //  
 } ext2_group_desc;
 
 // ڵṹ壬ļĿ¼Ԫݣռ 64 ֽ
@@ -52,448 +69,3089 @@ typedef struct ext2_dir_entry {
     char dir_pad;             // 
 } ext2_dir_entry;
 
+#define EXT2_GD_MAGIC 0x45583247    //  bg_magic ȡֵʾ־ͼβЧ
+#define EXT2_BG_ITABLE_UNINIT 0x1   // ڵĩβ bg_itable_unused ڵδfsck ض
+
 // ȫֱ
-ext2_group_desc group_desc;      // ʵ
 ext2_inode inode;                // ڵʵ
 ext2_dir_entry dir;              // Ŀ¼ʵ (洢ļĿ¼Ԫ)
-FILE *f;                         // ļָ (ļϵͳ)
+int disk_fd = -1;                // ̵ļ (ʱ򿪣пдãλöдûйļλ)
 unsigned int last_allco_inode = 0; // ϴηڵ
 unsigned int last_allco_block = 0; // ϴηݿ
 
-/**********һ**********/
-/**********ʼģļϵͳ**********/
-
-/*ļϵͳжȡĿ¼ inode ݣ洢 cu ָָ ext2_inode ṹС*/
-int initialize(ext2_inode *cu)
+/**********I/O ͳ**********/
+/**********ײÿζд뵱ǰִеĸ߲߲¼ôӳֱͼ stats ˳ʱ**********/
+#define STAT_OTHER 0           // вĶд (ء־ύʽ)
+#define STAT_OPEN 1
+#define STAT_READ 2
+#define STAT_WRITE 3
+#define STAT_CREATE 4
+#define STAT_DELETE 5
+#define STAT_LS 6
+#define STAT_PWD 7
+#define STAT_FINDBLOCK 8
+#define STAT_FINDINODE 9
+#define STAT_OPS 10            // ͳƵĲ
+#define STAT_BUCKETS 24        // ӳֱͼͰ k ͰΪС 2^k ΢ (ҲС 2^(k-1))
+
+char stat_names[STAT_OPS][12] = {"other", "Open", "Read", "Write", "Create", "Delete", "ls", "pwd", "FindBlock", "FindInode"};
+
+// һֲͳ
+typedef struct io_stat {
+    long long calls;              // ô
+    long long reads;              // pread 
+    long long writes;             // pwrite 
+    long long seeks;              // дλòһζдĩβĴ (൱һѰ)
+    long long opens;              // ̵Ĵ
+    long long syncs;              // fsync 
+    long long rbytes;             // ȡֽ
+    long long wbytes;             // дֽ
+    long long hits;               // 黺д
+    long long misses;             // 黺δд
+    double time;                  // ܺʱ ()
+    long long hist[STAT_BUCKETS]; // ӳֱͼ
+} io_stat;
+
+// һʱֳ
+typedef struct stat_ctx {
+    int prev;                     // 
+    double t0;                    // ʼʱ (Ϊʾͬһ)
+} stat_ctx;
+
+io_stat stats[STAT_OPS];
+__thread int stat_cur = STAT_OTHER; // ̵߳ǰִеĲ
+off_t stat_last_pos = -1;         // һζдλ
+pthread_mutex_t stat_mutex = PTHREAD_MUTEX_INITIALIZER; // ߳ͬʱͳʱ
+int stat_dump = 0;                // ˳ʱͳ ( -S ָ)
+
+double now_sec();
+
+/* op֮Ķд opݹ ( Delete ɾĿ¼ݡpwd ) ֻһ*/
+stat_ctx stat_enter(int op)
 {
-    f = fopen(PATH, "r+");                          // ļԶдģʽ
-    fseek(f, 3 * blocksiz, 0);                      // λ 3 飬ȡĿ¼ inode
-    fread(cu, sizeof(ext2_inode), 1, f);            // ݶ cu ָָĽṹ
-    fclose(f);                                      // رļ
-    return 0;
+    stat_ctx sc = {stat_cur, -1};
+    if (op != stat_cur)
+    {
+        sc.t0 = now_sec();
+        stat_cur = op;
+    }
+    return sc;
 }
 
-/*ûַʾݡ*/
-int getch() {
-    int ch; // ڱȡַ
-    struct termios oldt, newt; // ն˲ṹ壬ڱ޸ն
+/*뿪¼ʱָ retд return stat_leave(&sc, ret)*/
+int stat_leave(stat_ctx *sc, int ret)
+{
+    io_stat *st = &stats[stat_cur];
+    double us;
+    int k = 0;
+    if (sc->t0 >= 0)
+    {
+        us = (now_sec() - sc->t0) * 1e6;
+        while (k < STAT_BUCKETS - 1 && us >= (double)(1 << k))
+            k++;
+        pthread_mutex_lock(&stat_mutex);
+        st->calls++;
+        st->time += us / 1e6;
+        st->hist[k]++;
+        pthread_mutex_unlock(&stat_mutex);
+    }
+    stat_cur = sc->prev;
+    return ret;
+}
 
-    // ȡǰն˵Ĳã浽 `oldt` 
-    // STDIN_FILENO Ǳ׼루ļ 0
-    tcgetattr(STDIN_FILENO, &oldt);
-    // Ƶǰնõ `newt`׼޸
-    newt = oldt;
-    // ޸նã
-    // رջԣECHO: ַնʾ
-    // رչ淶ģʽICANONַҪ Enter ɶȡ
-    newt.c_lflag &= ~(ECHO | ICANON);
-    // ޸ĺĲЧնˣTCSANOW ʾЧ
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    // ӱ׼ȡַ
-    ch = getchar();
-    // ָԭʼնãûԺ͹淶ģʽ
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    // ûַ
-    return ch;
+/*¼һεײд*/
+void stat_io(int write, size_t len, off_t pos)
+{
+    io_stat *st = &stats[stat_cur];
+    pthread_mutex_lock(&stat_mutex);
+    if (write)
+    {
+        st->writes++;
+        st->wbytes += len;
+    }
+    else
+    {
+        st->reads++;
+        st->rbytes += len;
+    }
+    if (pos != stat_last_pos)
+        st->seeks++;
+    stat_last_pos = pos + len;
+    pthread_mutex_unlock(&stat_mutex);
 }
 
-/*˳ʾлϢ˳*/
-void exitdisplay()
+/*ֱͼ q λͰϽ (΢)*/
+long long stat_quantile(io_stat *st, double q)
 {
-    printf("лʹ~ ݰ\n");
-    return;
+    long long sum = 0;
+    int k;
+    for (k = 0; k < STAT_BUCKETS; k++)
+        if ((sum += st->hist[k]) >= q * st->calls)
+            break;
+    return 1LL << (k < STAT_BUCKETS ? k : STAT_BUCKETS - 1);
 }
 
-int format(ext2_inode *current);
-/*ʼļϵͳ,ļϵͳʼɹ 0;ļϵͳʼʧܣ 1*/
-int initfs(ext2_inode *cu)
+/*ͳƺӳֱͼ*/
+void stats_print(FILE *out)
 {
-    f = fopen(PATH, "r+");
-    if (f == NULL) // ļϵͳļ
+    io_stat *st;
+    int i, k;
+    fprintf(out, "%-10s %8s %8s %8s %8s %6s %6s %12s %12s %8s %8s %10s %8s %8s\n", "", "", "", "д", "Ѱ", "", "ͬ",
+            "ֽ", "дֽ", "", "δ", "ƽ(us)", "p50<us", "p99<us");
+    for (i = 0; i < STAT_OPS; i++)
     {
-        char ch; // ڴ洢û
-        int i;
-        printf("δҵļϵͳǷҪһµļϵͳ\n[Y/N]");
-        i = 1;
-        while (i) // ѭȴû
-        {
-            scanf("%c", &ch); // ȡû
-            switch (ch)
-            {
-            case 'Y':
-            case 'y': // ûѡ񴴽ļϵͳ
-                if (format(cu) != 0) // ʽļϵͳ
-                    return 1; // ʽʧܣ 1
-                f = fopen(PATH, "r"); // ļ
-                i = 0; // ֹͣѭ
-                break;
-            case 'N':
-            case 'n': // ûѡ񲻴ļϵͳ
-                exitdisplay(); // ʾ˳Ϣ
-                return 1; //  1ʾʼʧ
-            default:
-                printf("Ч\n"); // Чʾû
-                break;
-            }
-        }
+        st = &stats[i];
+        if (st->calls == 0 && st->reads == 0 && st->writes == 0 && st->hits == 0 && st->misses == 0 && st->opens == 0)
+            continue;
+        fprintf(out, "%-10s %8lld %8lld %8lld %8lld %6lld %6lld %12lld %12lld %8lld %8lld %10.1f %8lld %8lld\n", stat_names[i],
+                st->calls, st->reads, st->writes, st->seeks, st->opens, st->syncs, st->rbytes, st->wbytes, st->hits, st->misses,
+                st->calls ? st->time * 1e6 / st->calls : 0.0, st->calls ? stat_quantile(st, 0.5) : 0, st->calls ? stat_quantile(st, 0.99) : 0);
     }
+    for (i = 0; i < STAT_OPS; i++) // ӳֱͼ<Ͻ΢:
+    {
+        st = &stats[i];
+        if (st->calls == 0)
+            continue;
+        fprintf(out, "%-10s ӳٷֲ:", stat_names[i]);
+        for (k = 0; k < STAT_BUCKETS; k++)
+            if (st->hist[k])
+                fprintf(out, " <%lld:%lld", 1LL << k, st->hist[k]);
+        fprintf(out, "\n");
+    }
+}
 
-    // ļڣȡļϵͳϢ
-    fseek(f, 0, SEEK_SET);
-    fread(&group_desc, sizeof(ext2_group_desc), 1, f); // ȡ
-    fseek(f, 3 * blocksiz, SEEK_SET);
-    fread(&inode, sizeof(ext2_inode), 1, f); // ȡĿ¼ڵ
-    fclose(f);
-
-    initialize(cu); // ʼǰĿ¼
-    return 0; //  0ʾʼɹ
+/*̵ֽλ pos ȡ len ֽڣļĩβĲֲ㣬ʵʶֽ*/
+ssize_t disk_pread(void *buf, size_t len, off_t pos)
+{
+    ssize_t n;
+    size_t done = 0;
+    while (done < len && (n = pread(disk_fd, (char *)buf + done, len - done, pos + done)) > 0)
+    {
+        stat_io(0, n, pos + done);
+        done += n;
+    }
+    memset((char *)buf + done, 0, len - done);
+    return done;
 }
 
-/**********ڶ**********/
-/**********ļϵͳӺ**********/
+long disk_writes_begun = 0;       // ѿʼд (Ԥݴж϶Ƿѹʱ)
+long disk_writes_done = 0;        // ɵд
 
-/*ҿڵ*/
-int FindInode()
+/* len ֽд̵ֽλ pos*/
+void disk_pwrite(const void *buf, size_t len, off_t pos)
 {
-    FILE *fp = NULL;
-    unsigned int zero[blocksiz / 4]; // ڱinodeλͼ
-    int i;
-    while (fp == NULL)
-        fp = fopen(PATH, "r+"); // ļϵͳ
-    fseek(fp, 2 * blocksiz, SEEK_SET); // λinodeλͼ
-    fread(zero, blocksiz, 1, fp); // ȡinodeλͼ
-
-    for (i = last_allco_inode; i < (last_allco_inode + blocksiz / 4); i++) // inodeλͼ
+    ssize_t n;
+    size_t done = 0;
+    __sync_fetch_and_add(&disk_writes_begun, 1);
+    while (done < len)
     {
-        if (zero[i % (blocksiz / 4)] != 0xffffffff) // Ƿпеinode
+        if ((n = pwrite(disk_fd, (const char *)buf + done, len - done, pos + done)) <= 0)
         {
-            unsigned int j = 0x80000000, k = zero[i % (blocksiz / 4)], l = i;
-            for (i = 0; i < 32; i++) // 32λҵеλ
-            {
-                if (!(k & j)) // жϵǰλǷ
-                {
-                    zero[l % (blocksiz / 4)] |= j; // λΪռ
-                    group_desc.bg_free_inodes_count -= 1; // еĿinode
-                    fseek(fp, 0, 0); // λ
-                    fwrite(&group_desc, sizeof(ext2_group_desc), 1, fp); // д
-
-                    fseek(fp, 2 * blocksiz, SEEK_SET); // λinodeλͼ
-                    fwrite(zero, blocksiz, 1, fp); // inodeλͼ
-
-                    last_allco_inode = l % (blocksiz / 4); // ¼inode
-                    fclose(fp);
-                    return l % (blocksiz / 4) * 32 + i; // ؿinode
-                }
-                else
-                    j /= 2; // һλ
-            }
+            perror("д");
+            break;
         }
+        stat_io(1, n, pos + done);
+        done += n;
     }
-    fclose(fp);
-    return -1; // ûпinode
+    __sync_fetch_and_add(&disk_writes_done, 1);
 }
 
-/*ҿп*/
-int FindBlock()
+/*̵޸*/
+void disk_fsync()
 {
-    FILE *fp = NULL;
-    unsigned int zero[blocksiz / 4]; // ڱλͼ
-    int i;
-    while (fp == NULL)
-        fp = fopen(PATH, "r+"); // ļϵͳ
-    fseek(fp, 1 * blocksiz, SEEK_SET); // λλͼ
-    fread(zero, blocksiz, 1, fp); // ȡλͼ
+    pthread_mutex_lock(&stat_mutex);
+    stats[stat_cur].syncs++;
+    pthread_mutex_unlock(&stat_mutex);
+    fsync(disk_fd);
+}
+
+/**********̼β**********/
+/**********СͿڸʽʱȷ¼ 0 Уʱ**********/
+// Ĳ֣ |  0  |  1  | ... | ־
+// ÿΪλͼ (1 ) | ڵλͼ (1 ) | ڵ | ݿ (blocksiz*8 飬ǡһλͼʾ)
+// ݿźڵŶţ g ĵ k ݿΪ g*blocks_per_group+k k ڵΪ g*blocksiz*8+k
+// ûмβľɴ൱ 512 ֽڿ顢1 顢512 ڵ
+#define MIN_BLOCKSIZ 512       // СС (ݾɸʽ)
+#define MAX_BLOCKSIZ 65536     // С
+#define MIN_GROUP_BLOCKS 64    // һٰݿڵ
+
+int blocksiz = 512;            // ÿС (ֽ)
+int blocks = 4611;             // ܿ (־)
+int groups_count = 1;          // 
+int blocks_per_group = 4096;   // ÿݿ
+int last_group_blocks = 4096;  // һݿ (Сʱ blocks_per_group)
+int inodes_per_group = 2184;   // ÿõڵ
+int itable_blocks = 512;       // ÿڵĿ
+int gdt_blocks = 1;            // Ŀ
+int format_blocksiz = 512;     // ʽʱʹõĿС ( -b ָ)
+long long format_volume = 0;   // ʽʱľС (ֽڣ -s ָ0 ʾһ)
+
+ext2_group_desc *gdt = NULL;   //  (gdt[0] 롢־ͼβ)
+
+#define group_first_block(g) (gdt_blocks + (off_t)(g) * (2 + itable_blocks + blocks_per_group)) //  g ĵһ
+#define group_blocks(g) ((g) == groups_count - 1 ? last_group_blocks : blocks_per_group)  //  g ݿ
+#define bitmap_block(g, kind) (group_first_block(g) + (kind))  // kind Ϊ 0 ǿλͼΪ 1 ڵλͼ
+#define inode_group(n) ((n) / (blocksiz * 8))                  // ڵ n ڵ
+#define gdt_size(ngroups, bs) (((ngroups) * (long)sizeof(ext2_group_desc) + (bs) - 1) / (bs)) // Ŀ
+
+/*üβСÿڵһݿ·*/
+void geometry_set(int bs, int ngroups, int ipg, int last)
+{
+    blocksiz = bs;
+    groups_count = ngroups;
+    blocks_per_group = bs * 8;
+    last_group_blocks = last;
+    inodes_per_group = ipg;
+    itable_blocks = (int)(((long)ipg * sizeof(ext2_inode) + bs - 1) / bs);
+    gdt_blocks = (int)gdt_size(ngroups, bs);
+    blocks = (int)(group_first_block(ngroups - 1) + 2 + itable_blocks + last);
+    free(gdt);
+    gdt = calloc(gdt_blocks, bs);
+}
 
-    for (i = last_allco_block; i < (last_allco_block + blocksiz / 4); i++) // λͼ
+/*¾ļβڵԼռݿ 1/8 (512 ֽڿ顢ʱɲͬ)Сȷ
+  һԲСϷ̫Сʱ 1*/
+int geometry_format(int bs, long long volume)
+{
+    long long vblocks = volume / bs;
+    long span, data;
+    int ipg, ngroups = 1, last = bs * 8;
+    if (bs < MIN_BLOCKSIZ || bs > MAX_BLOCKSIZ || (bs & (bs - 1)))
+        return 1;
+    ipg = (int)((long)last * bs / (8 * sizeof(ext2_inode)));
+    if (ipg > bs * 8) // ڵλͼֻһ
+        ipg = bs * 8;
+    span = 2 + ((long)ipg * sizeof(ext2_inode) + bs - 1) / bs + bs * 8;
+    if (volume > 0)
     {
-        if (zero[i % (blocksiz / 4)] != 0xffffffff) // Ƿпп
+        while (gdt_size(ngroups + 1, bs) + ngroups * span + span - bs * 8 + MIN_GROUP_BLOCKS <= vblocks) // ٷһ
+            ngroups++;
+        if (ngroups == 1 && gdt_size(1, bs) + span > vblocks) // һ飬Сڵ
         {
-            unsigned int j = 0x80000000, k = zero[i % (blocksiz / 4)], l = i;
-            for (i = 0; i < 32; i++) // 32λҵеλ
-            {
-                if (!(k & j)) // жϵǰλǷ
-                {
-                    zero[l % (blocksiz / 4)] |= j; // λΪռ
-                    group_desc.bg_free_blocks_count -= 1; // еĿп
-                    fseek(fp, 0, 0); // λ
-                    fwrite(&group_desc, sizeof(ext2_group_desc), 1, fp); // д
-
-                    fseek(fp, 1 * blocksiz, SEEK_SET); // λλͼ
-                    fwrite(zero, blocksiz, 1, fp); // ¿λͼ
-
-                    last_allco_block = l % (blocksiz / 4); // ¼Ŀ
-                    fclose(fp);
-                    return l % (blocksiz / 4) * 32 + i; // ؿп
-                }
-                else
-                    j /= 2; // һλ
-            }
+            data = (vblocks - gdt_size(1, bs) - 2) * 8 / 9;
+            ipg = (int)(data * bs / (8 * sizeof(ext2_inode)));
+            if (ipg > bs * 8)
+                ipg = bs * 8;
+            span = 2 + ((long)ipg * sizeof(ext2_inode) + bs - 1) / bs + bs * 8;
         }
+        data = vblocks - gdt_size(ngroups, bs) - (ngroups - 1) * span - (span - bs * 8);
+        last = data < bs * 8 ? (int)data : bs * 8;
+        if (last < MIN_GROUP_BLOCKS || ipg < MIN_GROUP_BLOCKS)
+            return 1;
     }
-    fclose(fp);
-    return -1; // ûпп
+    geometry_set(bs, ngroups, ipg, last);
+    return 0;
 }
 
-// ɾָ inode ڵ㣬 inode λͼ
-void DelInode(int len) // len  inode 
+/*ʱ 0 β (һĴСɽ־λõó)ļΪ (δʽ) ʱֵǰ*/
+void geometry_load()
 {
-    unsigned int zero[blocksiz / 4], i;
-    int j;
-    f = fopen(PATH, "r+"); // ļϵͳ·
-    fseek(f, 2 * blocksiz, SEEK_SET); // λ inode λͼʼλ
-    fread(zero, blocksiz, 1, f); // ȡ inode λͼ zero 
-    i = 0x80000000; // ڰλĳʼֵ
-    for (j = 0; j < len % 32; j++) 
-        i = i / 2; //  i ƣλӦλ
-    zero[len / 32] = zero[len / 32] ^ i; // ͨλָ inode
-    fseek(f, 2 * blocksiz, SEEK_SET); // λ inode λͼʼλ
-    fwrite(zero, blocksiz, 1, f); // дظº inode λͼ
-    fclose(f); // رļ
+    ext2_group_desc gd;
+    if (disk_pread(&gd, sizeof(gd), 0) != sizeof(gd))
+        return;
+    if (gd.bg_magic == EXT2_GD_MAGIC && gd.bg_block_size >= MIN_BLOCKSIZ && gd.bg_groups > 0)
+    {
+        geometry_set(gd.bg_block_size, gd.bg_groups, gd.bg_inodes_per_group, gd.bg_block_size * 8); // Ȱȷλ
+        last_group_blocks = (int)(gd.bg_journal_block - group_first_block(groups_count - 1) - 2 - itable_blocks);
+        blocks = gd.bg_journal_block;
+    }
+    else // ɸʽ
+        geometry_set(512, 1, 512 * 512 / sizeof(ext2_inode), 4096);
 }
 
-// ɾָݿ飬¿λͼ
-void DelBlock(int len)
+// ݿ n еľֽλ
+#define block_pos(n) ((group_first_block((n) / blocks_per_group) + 2 + itable_blocks + (n) % blocks_per_group) * blocksiz)
+// n ڵľֽλ
+#define inode_pos(n) ((group_first_block(inode_group(n)) + 2) * blocksiz + (off_t)((n) % (blocksiz * 8)) * sizeof(ext2_inode))
+
+
+/********************/
+/**********ÿڵһѶд (λͼԤڡ) һѶ湲һѻ**********/
+// Щֻͬһ̵֮߳以⣺λͼ͸涼פڽڴСӳдأ
+// һͬһʱֻһ̹ (mount_disk ļ flock ռ)ͻӦͨ ext2_server 
+// ˳ȸĿ¼ȻǷڲ㣻ͬһ߳̿ظͬһڵд
+// лڼ䲻ټһ߳ͬʱڵ (ĵǰĿ¼Ŀ¼
+// ݹɾĿ¼ʱȷſȵ)ͬʱ߳
+#define ILOCK_SLOTS 64               //  (ͬʱڵ)
+
+// еһ
+typedef struct ilock {
+    int ino;                  // ڵ (-1 ʾ)
+    int users;                // лȴ߳Ϊ 0 ʱͷű
+    int depth;                // д
+    pthread_t owner;          // д߳
+    pthread_rwlock_t rw;      // д
+} ilock;
+
+ilock ilock_table[ILOCK_SLOTS];
+pthread_mutex_t ilock_mutex = PTHREAD_MUTEX_INITIALIZER; // 
+pthread_cond_t ilock_cond = PTHREAD_COND_INITIALIZER;    // ʱȴ
+int ilock_ready = 0;                                     // Ƿѳʼ
+pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER; // 
+__thread int alloc_depth = 0;                            // ̳߳зǶ
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER; // 
+__thread int cache_depth = 0;                            // ̳߳лǶ
+
+/*ȡ ino ڵʱ ilock_mutex*/
+ilock *ilock_get(int ino)
 {
-    unsigned int zero[blocksiz / 4], i;
-    int j;
-    f = fopen(PATH, "r+"); // ļϵͳ·
-    fseek(f, 1 * blocksiz, SEEK_SET); // λλͼʼλ
-    fread(zero, blocksiz, 1, f); // ȡλͼ zero 
-    i = 0x80000000; // ڰλĳʼֵ
-    for (j = 0; j < len % 32; j++) 
-        i = i / 2; //  i ƣλӦλ
-    zero[len / 32] = zero[len / 32] ^ i; // ͨλָ
-    fseek(f, 1 * blocksiz, SEEK_SET); // λؿλͼʼλ
-    fwrite(zero, blocksiz, 1, f); // дظºĿλͼ
-    fclose(f); // رļ
+    int i, free_slot;
+    if (!ilock_ready)
+    {
+        for (i = 0; i < ILOCK_SLOTS; i++)
+        {
+            ilock_table[i].ino = -1;
+            pthread_rwlock_init(&ilock_table[i].rw, NULL);
+        }
+        ilock_ready = 1;
+    }
+    for (;;)
+    {
+        free_slot = -1;
+        for (i = 0; i < ILOCK_SLOTS; i++)
+        {
+            if (ilock_table[i].ino == ino)
+                return &ilock_table[i];
+            if (ilock_table[i].ino == -1 && free_slot < 0)
+                free_slot = i;
+        }
+        if (free_slot >= 0)
+        {
+            ilock_table[free_slot].ino = ino;
+            ilock_table[free_slot].users = 0;
+            ilock_table[free_slot].depth = 0;
+            return &ilock_table[free_slot];
+        }
+        pthread_cond_wait(&ilock_cond, &ilock_mutex); // ȴ߳̽
+    }
 }
 
-// һݿ鵽ǰļУֱ֧һͶ
-void add_block(ext2_inode *current, int i, int j) // i ʾݿţj ·ݿ
+/* ino ڵwrite Ϊ 1 д (ռ)Ϊ 0 Ӷ ()߳ѳдʱֻ*/
+void inode_lock(int ino, int write)
 {
-    FILE *fp = NULL;
-    while (fp == NULL)
-        fp = fopen(PATH, "r+"); // ļϵͳ·
+    ilock *l;
+    pthread_mutex_lock(&ilock_mutex);
+    l = ilock_get(ino);
+    if (l->depth > 0 && pthread_equal(l->owner, pthread_self()))
+    {
+        l->depth++;
+        pthread_mutex_unlock(&ilock_mutex);
+        return;
+    }
+    l->users++;
+    pthread_mutex_unlock(&ilock_mutex);
 
-    if (i < 6) // ʹֱ
+    if (write)
     {
-        current->i_block[i] = j; // ݿֱд i_block 
+        pthread_rwlock_wrlock(&l->rw);
+        pthread_mutex_lock(&ilock_mutex);
+        l->owner = pthread_self();
+        l->depth = 1;
+        pthread_mutex_unlock(&ilock_mutex);
     }
     else
+        pthread_rwlock_rdlock(&l->rw);
+}
+
+/*ͷ inode_lock ӵ (дͷ)*/
+void inode_unlock(int ino)
+{
+    ilock *l;
+    pthread_mutex_lock(&ilock_mutex);
+    l = ilock_get(ino);
+    if (l->depth > 0 && pthread_equal(l->owner, pthread_self()))
     {
-        i = i - 6; // żȥֱ
-        if (i == 0) // Ϊһݿ
-        {
-            current->i_block[6] = FindBlock(); // һµݿ洢һ
-            fseek(fp, data_begin_block * blocksiz + current->i_block[6] * blocksiz, SEEK_SET);
-            fwrite(&j, sizeof(int), 1, fp); // дһݿ
-        }
-        else if (i < 128) // һзݿ
+        if (--l->depth > 0) // 
         {
-            fseek(fp, data_begin_block * blocksiz + current->i_block[6] * blocksiz + i * 4, SEEK_SET);
-            fwrite(&j, sizeof(int), 1, fp); // дӦݿ
-        }
-        else // 
-        {
-            i = i - 128; // żȥһ
-            if (i == 0) // 
-            {
-                current->i_block[7] = FindBlock(); // һµĶ
-                fseek(fp, data_begin_block * blocksiz + current->i_block[7] * blocksiz, SEEK_SET);
-                i = FindBlock(); // Ϊһµݿ
-                fwrite(&i, sizeof(int), 1, fp); 
-                fseek(fp, data_begin_block * blocksiz + i * blocksiz, SEEK_SET);
-                fwrite(&j, sizeof(int), 1, fp); // дݿ
-            }
-            if (i % 128 == 0) // ǰҪµĿ
-            {
-                fseek(fp, data_begin_block * blocksiz + current->i_block[7] * blocksiz + i / 128 * 4, SEEK_SET);
-                i = FindBlock(); // µĿ
-                fwrite(&i, sizeof(int), 1, fp); 
-                fseek(fp, data_begin_block * blocksiz + i * blocksiz, SEEK_SET);
-                fwrite(&j, sizeof(int), 1, fp); // дݿ
-            }
-            else // Ѵڿ
-            {
-                fseek(fp, data_begin_block * blocksiz + current->i_block[7] * blocksiz + i / 128 * 4, SEEK_SET);
-                fread(&i, sizeof(int), 1, fp); // ȡ
-                fseek(fp, data_begin_block * blocksiz + i * blocksiz + i % 128 * 4, SEEK_SET);
-                fwrite(&j, sizeof(int), 1, fp); // дݿ
-            }
+            pthread_mutex_unlock(&ilock_mutex);
+            return;
         }
     }
+    pthread_mutex_unlock(&ilock_mutex);
+    pthread_rwlock_unlock(&l->rw);
+
+    pthread_mutex_lock(&ilock_mutex);
+    if (--l->users == 0)
+    {
+        l->ino = -1;
+        pthread_cond_broadcast(&ilock_cond);
+    }
+    pthread_mutex_unlock(&ilock_mutex);
+}
+
+/*ӷ (Ƕ)ֻ޸λͼԤںڼ*/
+void alloc_lock()
+{
+    if (alloc_depth++ > 0)
+        return;
+    pthread_mutex_lock(&alloc_mutex);
+}
+
+void alloc_unlock()
+{
+    if (--alloc_depth > 0)
+        return;
+    pthread_mutex_unlock(&alloc_mutex);
+}
+
+/*ӻ (Ƕ)黺桢ڵ㻺桢Ŀ¼־ύ״̬*/
+void cache_lock()
+{
+    if (cache_depth++ == 0)
+        pthread_mutex_lock(&cache_mutex);
 }
 
-// Ŀ¼Ĵ洢λƫÿĿ¼ռ 32 ֽ
-int dir_entry_position(int dir_entry_begin, int i_block[8]) // dir_entry_begin ʾĿ¼ʼֽ
+void cache_unlock()
 {
-    int dir_blocks = dir_entry_begin / 512;   // Ŀ¼ԽĿ
-    int block_offset = dir_entry_begin % 512; // ǰڵֽƫ
-    int a; // ʱڴ洢ֵ
-    FILE *fp = NULL;
+    if (--cache_depth == 0)
+        pthread_mutex_unlock(&cache_mutex);
+}
 
-    if (dir_blocks <= 5) // Ŀ¼ֱ
+/**********黺**********/
+/**********кͨ黺д̣ⷴ open/close Сϵͳ**********/
+
+#define BCACHE_SIZE 128        // 黺 ()
+#define BCACHE_MAX 512         // ־ʱ黺ʱĿ (һύ־)
+#define BCACHE_HASH 64         // 黺ϣͰ
+
+// ṹ壬еһ
+typedef struct buffer_head {
+    int b_blocknr;                 // Ŀ (-1 ʾ)
+    int b_dirty;                   // Ƿ޸Ĺ (дش)
+    struct buffer_head *b_prev;    // LRU ǰ (ͷĿʹ)
+    struct buffer_head *b_next;    // LRU 
+    struct buffer_head *b_hnext;   // ϣ
+    char *b_data;                  //  (blocksiz ֽڣʱС)
+} buffer_head;
+
+buffer_head bcache[BCACHE_MAX];          //  (ǰ bcache_count )
+int bcache_count = BCACHE_SIZE;          //  BCACHE_SIZE Ŀύ黹
+buffer_head *bhash[BCACHE_HASH];         // ɢеĹϣ
+buffer_head *lru_head = NULL;            // LRU ͷ (ʹ)
+buffer_head *lru_tail = NULL;            // LRU β (δʹã̭)
+char *bcache_data = NULL;                // л
+
+int mount_mmap = 0;                      // ģʽ (1: ӳ䵽ڴ)
+char *disk_map = NULL;                   // ̵ڴӳʼַ
+off_t disk_len = 0;                       // ڴӳĳ (ֽ)
+int journal_active = 0;                  // ǷͨԪ־д
+
+void journal_write_dirty(); // Ԫ־ж
+int journal_capacity();     // Ԫ־ж
+
+/*ʼ黺棬ǰСл鲢 LRU */
+void bcache_init()
+{
+    int i;
+    for (i = BCACHE_SIZE; i < bcache_count; i++) // 黹ʱӵĻ
+        free(bcache[i].b_data);
+    bcache_count = BCACHE_SIZE;
+    bcache_data = realloc(bcache_data, (size_t)BCACHE_SIZE * blocksiz);
+    for (i = 0; i < BCACHE_HASH; i++)
+        bhash[i] = NULL;
+    for (i = 0; i < BCACHE_SIZE; i++)
     {
-        return data_begin_block * blocksiz + i_block[dir_blocks] * blocksiz + block_offset;
+        bcache[i].b_data = bcache_data + (size_t)i * blocksiz;
+        bcache[i].b_blocknr = -1;
+        bcache[i].b_dirty = 0;
+        bcache[i].b_hnext = NULL;
+        bcache[i].b_prev = i > 0 ? &bcache[i - 1] : NULL;
+        bcache[i].b_next = i < BCACHE_SIZE - 1 ? &bcache[i + 1] : NULL;
     }
-    else // Ŀ¼ڼ
-    {
-        while (fp == NULL) // ȷļɹ
-            fp = fopen(PATH, "r+");
+    lru_head = &bcache[0];
+    lru_tail = &bcache[BCACHE_SIZE - 1];
+}
 
-        dir_blocks -= 6; // ȥֱ
+/*д*/
+void bwrite_back(buffer_head *bh)
+{
+    disk_pwrite(bh->b_data, blocksiz, (off_t)bh->b_blocknr * blocksiz);
+    bh->b_dirty = 0;
+}
 
-        if (dir_blocks < 128) // һ128 Ϊɵ
-        {
-            fseek(fp, data_begin_block * blocksiz + i_block[6] * blocksiz + dir_blocks * 4, SEEK_SET);
-            fread(&a, sizeof(int), 1, fp);
-            return data_begin_block * blocksiz + a * blocksiz + block_offset;
-        }
-        else // 
-        {
-            dir_blocks -= 128; // ȥһ
+/*ѻƶ LRU ͷ*/
+void lru_touch(buffer_head *bh)
+{
+    if (bh == lru_head)
+        return;
+    bh->b_prev->b_next = bh->b_next; // ԭλժ
+    if (bh->b_next)
+        bh->b_next->b_prev = bh->b_prev;
+    else
+        lru_tail = bh->b_prev;
+    bh->b_prev = NULL; // ͷ
+    bh->b_next = lru_head;
+    lru_head->b_prev = bh;
+    lru_head = bh;
+}
+
+/*ӹϣժ*/
+void bhash_remove(buffer_head *bh)
+{
+    buffer_head **p = &bhash[bh->b_blocknr % BCACHE_HASH];
+    while (*p != bh)
+        p = &(*p)->b_hnext;
+    *p = bh->b_hnext;
+}
 
-            // λ鲢ȡֵ
-            fseek(fp, data_begin_block * blocksiz + i_block[7] * blocksiz + (dir_blocks / 128) * 4, SEEK_SET);
-            fread(&a, sizeof(int), 1, fp);
+/*һл鲢 LRU β (߳л)*/
+buffer_head *bcache_grow()
+{
+    buffer_head *bh = &bcache[bcache_count++];
+    bh->b_data = malloc(blocksiz);
+    bh->b_blocknr = -1;
+    bh->b_dirty = 0;
+    bh->b_hnext = NULL;
+    bh->b_prev = lru_tail;
+    bh->b_next = NULL;
+    lru_tail->b_next = bh;
+    lru_tail = bh;
+    return bh;
+}
 
-            // λӦһ鲢ȡյַ
-            fseek(fp, data_begin_block * blocksiz + a * blocksiz + (dir_blocks % 128) * 4, SEEK_SET);
-            fread(&a, sizeof(int), 1, fp);
+/*ύĩβ黹ʱӵĻ飬Ϊֹ (߳лûδĻָ)*/
+void bcache_shrink()
+{
+    buffer_head *bh;
+    while (bcache_count > BCACHE_SIZE && !bcache[bcache_count - 1].b_dirty) // ύ߳̿Ū
+    {
+        bh = &bcache[--bcache_count];
+        if (bh->b_blocknr != -1)
+            bhash_remove(bh);
+        if (bh->b_prev) //  LRU ժ
+            bh->b_prev->b_next = bh->b_next;
+        else
+            lru_head = bh->b_next;
+        if (bh->b_next)
+            bh->b_next->b_prev = bh->b_prev;
+        else
+            lru_tail = bh->b_prev;
+        free(bh->b_data);
+    }
+}
 
-            return data_begin_block * blocksiz + a * blocksiz + block_offset;
+/*ȡÿΪ blocknr Ļ飬δʱ̭δʹõĿ鲢Ӵ̶ (߳л)*/
+buffer_head *bread(int blocknr)
+{
+    buffer_head *bh;
+    for (bh = bhash[blocknr % BCACHE_HASH]; bh != NULL; bh = bh->b_hnext) // ҹϣ
+        if (bh->b_blocknr == blocknr)
+        {
+            __sync_fetch_and_add(&stats[stat_cur].hits, 1); // ͳƱ stat_mutex ·ֻԭӼ
+            lru_touch(bh);
+            return bh;
         }
+    __sync_fetch_and_add(&stats[stat_cur].misses, 1);
 
-        fclose(fp); // رļ
+    bh = lru_tail; // ̭ LRU β
+    if (journal_active) // ־ʱֻύдأ̭ɾĿ
+    {
+        while (bh != NULL && bh->b_blocknr != -1 && bh->b_dirty)
+            bh = bh->b_prev;
+        if (bh == NULL && bcache_count < BCACHE_MAX && bcache_count < journal_capacity())
+            bh = bcache_grow(); // ȫ飺ʱ󻺴棬ñβ޸ͬһ
+        else if (bh == NULL) // һύҲɲ£ֻύе޸
+        {
+            journal_write_dirty();
+            bh = lru_tail;
+        }
+    }
+    if (bh->b_blocknr != -1)
+    {
+        if (bh->b_dirty)
+            bwrite_back(bh); // д
+        bhash_remove(bh);
     }
+    bh->b_blocknr = blocknr;
+    bh->b_dirty = 0;
+    disk_pread(bh->b_data, blocksiz, (off_t)blocknr * blocksiz); // ļĩβĲΪȫ
+    bh->b_hnext = bhash[blocknr % BCACHE_HASH];
+    bhash[blocknr % BCACHE_HASH] = bh;
+    lru_touch(bh);
+    return bh;
 }
 
-// ΪǰĿ¼ѰһĿ¼ĿλòؾԵַ
-int FindEntry(ext2_inode *current)
+/*һ pread ȡݣÿ黺нµݸǣݴ뻺*/
+void disk_read_direct(off_t pos, char *buf, int len)
 {
-    FILE *fout = NULL;
-    int location;       // Ŀľλ
-    int block_location; // 
-    int temp;           // ÿblockԴŵINT
-    int remain_block;   // ʣ
-    location = data_begin_block * blocksiz; // ݿʼλÿʼ
-    temp = blocksiz / sizeof(int); // ÿԴŶٸINT
-    fout = fopen(PATH, "r+"); // Զдģʽļ
-    if (current->i_size % blocksiz == 0) // ǰĿ¼ĴСǿ˵ǰҪһ¿
+    buffer_head *bh;
+    int i;
+    off_t lo, hi;
+    disk_pread(buf, len, pos); // ļĩβĲΪȫ
+    cache_lock();
+    for (i = 0; i < bcache_count; i++) // еĿܱȴ
     {
-        add_block(current, current->i_blocks, FindBlock()); // һµݿ
-        current->i_blocks++; // ¿
+        bh = &bcache[i];
+        if (bh->b_blocknr == -1 || !bh->b_dirty)
+            continue;
+        lo = (off_t)bh->b_blocknr * blocksiz;
+        hi = lo + blocksiz;
+        if (hi <= pos || lo >= pos + len)
+            continue;
+        if (lo < pos)
+            lo = pos;
+        if (hi > pos + len)
+            hi = pos + len;
+        memcpy(buf + (lo - pos), bh->b_data + (lo - (off_t)bh->b_blocknr * blocksiz), hi - lo);
     }
-    if (current->i_blocks < 6) // ǰ6Ϊֱ
+    cache_unlock();
+}
+
+/*̵ľֽλ pos ȡ len ֽڵ bufɿ*/
+void disk_read(off_t pos, void *buf, int len)
+{
+    char *p = (char *)buf;
+    if (disk_map != NULL) // ڴӳģʽֱӿ
     {
-        location += current->i_block[current->i_blocks - 1] * blocksiz; // 㵱ǰĿ¼Ŀλ
-        location += current->i_size % blocksiz; // ڵǰҵλ
+        memcpy(buf, disk_map + pos, len);
+        return;
     }
-    else if (current->i_blocks < temp + 5) // һ
+    if (len >= 2 * blocksiz) // Ĵζȡƹ黺棬һζ
     {
-        block_location = current->i_block[6]; // ȡһĿ
-        fseek(fout, (data_begin_block + block_location) * blocksiz + (current->i_blocks - 6) * sizeof(int), SEEK_SET); 
-        fread(&block_location, sizeof(int), 1, fout); // ȡ
-        location += block_location * blocksiz; // λ
-        location += current->i_size % blocksiz; // ڸÿҵλ
+        disk_read_direct(pos, buf, len);
+        return;
     }
-    else // 
+    cache_lock();
+    while (len > 0)
     {
-        block_location = current->i_block[7]; // ȡĿ
-        remain_block = current->i_blocks - 6 - temp; // ʣ
-        fseek(fout, (data_begin_block + block_location) * blocksiz + (int)((remain_block - 1) / temp + 1) * sizeof(int), SEEK_SET); 
-        fread(&block_location, sizeof(int), 1, fout); // ȡ
-        remain_block = remain_block % temp; // ʣ
-        fseek(fout, (data_begin_block + block_location) * blocksiz + remain_block * sizeof(int), SEEK_SET); 
-        fread(&block_location, sizeof(int), 1, fout); // ȡ
-        location += block_location * blocksiz; // λ
-        location += current->i_size % blocksiz + dirsiz; // ڸÿҵλòĿ¼ĿС
+        int off = pos % blocksiz;                       // ƫ
+        int n = blocksiz - off < len ? blocksiz - off : len; // ɶֽ
+        memcpy(p, bread(pos / blocksiz)->b_data + off, n);
+        p += n;
+        pos += n;
+        len -= n;
     }
-    current->i_size += dirsiz; // µǰĿ¼ĴС
-    fclose(fout); // رļ
-    return location; // ҵĿĿ¼Ŀλ
+    cache_unlock();
 }
 
-/*¼֤洢Ƿƥ䣬ƥ䣬򷵻 0벻ƥ䣬򷵻طֵ*/
-int login()
+/*һ pwrite дݣͬ¿黺еĸ*/
+void disk_write_direct(off_t pos, const char *buf, int len)
 {
-    char psw[16]; // ڴ洢
-    printf("루ԭʼΪ9331");
-    scanf("%s", psw); // 
-    return strcmp(group_desc.password, psw); // Ƚ洢
+    buffer_head *bh;
+    int i;
+    off_t lo, hi;
+    cache_lock();
+    for (i = 0; i < bcache_count; i++) // ֻ渱һ
+    {
+        bh = &bcache[i];
+        if (bh->b_blocknr == -1)
+            continue;
+        lo = (off_t)bh->b_blocknr * blocksiz;
+        hi = lo + blocksiz;
+        if (hi <= pos || lo >= pos + len)
+            continue;
+        if (lo < pos)
+            lo = pos;
+        if (hi > pos + len)
+            hi = pos + len;
+        memcpy(bh->b_data + (lo - (off_t)bh->b_blocknr * blocksiz), buf + (lo - pos), hi - lo);
+    }
+    cache_unlock();
+    disk_pwrite(buf, len, pos); // дʱл߳̿Բд
 }
 
-int Open(ext2_inode *current, char *name);//Open
+/* buf е len ֽд黺沢Ϊ飬۳ȶƹ档
+  Ԫݱд룬־ʱŻһύ*/
+void disk_write_cached(off_t pos, const void *buf, int len)
+{
+    const char *p = (const char *)buf;
+    if (disk_map != NULL) // ڴӳģʽֱдӳ msync 
+    {
+        memcpy(disk_map + pos, buf, len);
+        return;
+    }
+    cache_lock();
+    while (len > 0)
+    {
+        int off = pos % blocksiz;
+        int n = blocksiz - off < len ? blocksiz - off : len;
+        buffer_head *bh = bread(pos / blocksiz);
+        memcpy(bh->b_data + off, p, n);
+        bh->b_dirty = 1;
+        p += n;
+        pos += n;
+        len -= n;
+    }
+    cache_unlock();
+}
 
-/*ȡǰĿ¼Ŀ¼ cs_name_nameڴ洢ȡĿ¼ nodeǰĿ¼ڵ*/
-void getstring(char *cs_name, ext2_inode node)
+/* buf е len ֽд̵ľֽλ posֻ޸Ļ沢Ϊ顣
+  Ĵд (ļ) ƹ黺һд꣬־*/
+void disk_write(off_t pos, const void *buf, int len)
 {
-    ext2_inode current = node; // ǰĿ¼ڵ
-    int i, j;
-    ext2_dir_entry dir; // Ŀ¼
-    f = fopen(PATH, "r+"); // ļϵͳ
+    if (disk_map == NULL && len >= 2 * blocksiz)
+        disk_write_direct(pos, buf, len);
+    else
+        disk_write_cached(pos, buf, len);
+}
 
-    // 򿪸Ŀ¼
-    Open(&current, ".."); // currentָĿ¼ϼĿ¼
+/*ؾֽλ pos ڴӳеָ룬δʹڴӳģʽʱ NULL*/
+void *disk_ptr(off_t pos)
+{
+    return disk_map != NULL ? disk_map + pos : NULL;
+}
 
-    // ҵǰĿ¼е"."ʾǰĿ¼ȡӦڵ
-    for (i = 0; i < node.i_size / 32; i++)
+/**********ӳ仺**********/
+/**********ŻĿűbmap ߼ʱֻ飻޸ʱͬ£鱻ͷʱʧЧ**********/
+#define MCACHE_SIZE 64         //  (ֱӳ)
+
+typedef struct map_cache {
+    int m_block;               //  (-1 ʾ)
+    int *m_ptrs;               // еȫ
+} map_cache;
+
+map_cache mcache[MCACHE_SIZE];
+
+/*տӳ仺 (غ־طźãСѾı)*/
+void mcache_init()
+{
+    int i;
+    for (i = 0; i < MCACHE_SIZE; i++)
     {
-        fseek(f, dir_entry_position(i * 32, node.i_block), SEEK_SET); // λǰĿ¼
-        fread(&dir, sizeof(ext2_dir_entry), 1, f); // ȡĿ¼
-        if (!strcmp(dir.name, ".")) // Ŀ¼Ϊ"."ǰĿ¼
-        {
-            j = dir.inode; // Ŀ¼Ӧڵ
-            break;
-        }
+        free(mcache[i].m_ptrs);
+        mcache[i].m_ptrs = NULL;
+        mcache[i].m_block = -1;
     }
+}
 
-    // ҸĿ¼뵱ǰĿ¼ӦĿ¼ȡ
-    for (i = 0; i < current.i_size / 32; i++)
+/* blk еĵ k ţδʱ뻺*/
+int map_get(int blk, int k)
+{
+    map_cache *mc = &mcache[blk % MCACHE_SIZE];
+    int a;
+    cache_lock();
+    if (mc->m_block != blk)
     {
-        fseek(f, dir_entry_position(i * 32, current.i_block), SEEK_SET); // λĿ¼
-        fread(&dir, sizeof(ext2_dir_entry), 1, f); // ȡĿ¼
-        if (dir.inode == j) // Ŀ¼ڵ뵱ǰĿ¼ͬ
-        {
-            strcpy(cs_name, dir.name); // Ŀ¼Ƶַ cs_name 
-            return; // 
-        }
+        if (mc->m_ptrs == NULL)
+            mc->m_ptrs = malloc(blocksiz);
+        disk_read(block_pos(blk), mc->m_ptrs, blocksiz);
+        mc->m_block = blk;
     }
+    a = mc->m_ptrs[k];
+    cache_unlock();
+    return a;
 }
 
-/********************/
-/**********㺯**********/
+/* blk е from  to-1 Ϊ vals еֵ (vals Ϊ NULL ʱ)ͬʱ»*/
+void map_set(int blk, int from, int to, const int *vals)
+{
+    map_cache *mc = &mcache[blk % MCACHE_SIZE];
+    int *zero = NULL;
+    if (vals == NULL)
+        vals = zero = calloc(to - from, sizeof(int));
+    cache_lock();
+    disk_write(block_pos(blk) + from * sizeof(int), vals, (to - from) * sizeof(int));
+    if (mc->m_block == blk)
+        memcpy(mc->m_ptrs + from, vals, (to - from) * sizeof(int));
+    cache_unlock();
+    free(zero);
+}
 
-/*ָĿ¼ΪǰĿ¼,current ָ´򿪵ĵǰĿ¼ext2_inode*/
-int Open(ext2_inode *current, char *name)
+/*ݿ blk ͷţ*/
+void map_forget(int blk)
 {
-    FILE *fp = NULL;
-    int i;
+    cache_lock();
+    if (mcache[blk % MCACHE_SIZE].m_block == blk)
+        mcache[blk % MCACHE_SIZE].m_block = -1;
+    cache_unlock();
+}
+
+void alloc_flush(); // λͼж
+void ra_drain(); // Ԥж
+void icache_writeback(int force); // ڵ㻺ж
+void icache_init();
+void dx_state_init(); // Ŀ¼ϣж
+
+/**********Ԫ־**********/
+/**********ÿ޸һϲΪһύȰӳύ˳д־̣дԭλ**********/
+#define JOURNAL_MAGIC 0x4a424432    // ־ͷħ
+#define JOURNAL_DESCRIPTOR 1        // 飺¼ύĸԭλ
+#define JOURNAL_COMMIT 2            // ύ飺¼Уͣд꼴ʾύ
+#define JOURNAL_BLOCKS 256          // ־ (ʽʱ׷֮)
+#define JOURNAL_INTERVAL 1          // δύȴ
+
+typedef struct journal_header {
+    int h_magic;    // JOURNAL_MAGIC
+    int h_type;     // JOURNAL_DESCRIPTOR  JOURNAL_COMMIT
+    int h_seq;      // ύ
+    int h_count;    // ύĿ
+    unsigned int h_checksum; // ύΪпӳУ
+} journal_header;
+
+#define JOURNAL_TAGS ((int)((blocksiz - sizeof(journal_header)) / sizeof(int))) // ÿɼ¼Ŀ
+
+int journal_batch = 8;           // ÿύϲ ( -j ָ1 ʾÿύһ)
+int journal_pending = 0;         // ѽδύ
+int journal_seq = 1;             // һύ
+time_t journal_last_commit = 0;  // ϴύʱ
+
+unsigned int journal_checksum(unsigned int h, const char *p, int len) // FNV-1a
+{
+    while (len-- > 0)
+        h = (h ^ (unsigned char)*p++) * 16777619u;
+    return h;
+}
+
+/*־ĵһ㣬ʾ־ûдطŵύ*/
+void journal_reset()
+{
+    char zero[blocksiz];
+    memset(zero, 0, blocksiz);
+    disk_pwrite(zero, blocksiz, (off_t)gdt[0].bg_journal_block * blocksiz);
+    disk_fsync();
+}
+
+/*һύܼ¼Ŀ ( + ӳ + ύ鲻־)*/
+int journal_capacity()
+{
+    int n = gdt[0].bg_journal_blocks - 2;
+    while (n > 0 && n + (n + JOURNAL_TAGS - 1) / JOURNAL_TAGS + 1 > gdt[0].bg_journal_blocks)
+        n--;
+    return n;
+}
 
-    while (fp == NULL) // ȷļɹ
-        fp = fopen(PATH, "r+");
+/* list е n Ϊһύ + ӳ + ύһ˳д벢 fsyncдԭλã־
+  ߳лn  journal_capacity()*/
+void journal_write_list(buffer_head **list, int n)
+{
+    journal_header *jh;
+    char *log;
+    int ndesc, i;
+    unsigned int sum = 2166136261u;
+
+    ndesc = (n + JOURNAL_TAGS - 1) / JOURNAL_TAGS;
+    log = calloc(ndesc + n + 1, blocksiz);
+    for (i = 0; i < n; i++) // 飺ͷ + ű
+    {
+        jh = (journal_header *)(log + (i / JOURNAL_TAGS) * blocksiz);
+        jh->h_magic = JOURNAL_MAGIC;
+        jh->h_type = JOURNAL_DESCRIPTOR;
+        jh->h_seq = journal_seq;
+        jh->h_count = n;
+        ((int *)(jh + 1))[i % JOURNAL_TAGS] = list[i]->b_blocknr;
+        memcpy(log + (ndesc + i) * blocksiz, list[i]->b_data, blocksiz);
+        sum = journal_checksum(sum, list[i]->b_data, blocksiz);
+    }
+    jh = (journal_header *)(log + (ndesc + n) * blocksiz); // ύ
+    jh->h_magic = JOURNAL_MAGIC;
+    jh->h_type = JOURNAL_COMMIT;
+    jh->h_seq = journal_seq;
+    jh->h_count = n;
+    jh->h_checksum = sum;
+
+    disk_pwrite(log, (size_t)(ndesc + n + 1) * blocksiz, (off_t)gdt[0].bg_journal_block * blocksiz);
+    disk_fsync(); // ύ̺ܸдԭλ
+    free(log);
+
+    for (i = 0; i < n; i++) // дԭλ (checkpoint)
+        bwrite_back(list[i]);
+    disk_fsync(); // ԭλ̺־ʱύ޸ļȲԭλҲ־
+    journal_reset();
+    journal_seq++;
+}
 
-    for (i = 0; i < (current->i_size / 32); i++) // ǰĿ¼еĿ¼
+/*ѿ黺ȫд־ύһύʱֳɼ*/
+void journal_write_dirty()
+{
+    buffer_head **list;
+    int n = 0, i, cap = journal_capacity();
+
+    cache_lock();
+    list = malloc(bcache_count * sizeof(buffer_head *));
+    for (i = 0; i < bcache_count; i++)
+        if (bcache[i].b_blocknr != -1 && bcache[i].b_dirty)
+            list[n++] = &bcache[i];
+    for (i = 0; i < n; i += cap)
+        journal_write_list(list + i, n - i < cap ? n - i : cap);
+    free(list);
+    cache_unlock();
+}
+
+/*ύѽӳдصڵλͼҲһд뱾ύ*/
+void journal_commit()
+{
+    icache_writeback(1);
+    alloc_flush();
+    journal_write_dirty();
+    cache_lock();
+    bcache_shrink(); // ֮ûδĻָ룬Թ黹ʱӵĿ
+    journal_pending = 0;
+    time(&journal_last_commit);
+    cache_unlock();
+}
+
+/*һ񣺴 journal_batch 񡢾ϴύ JOURNAL_INTERVAL 黺ʱʱύ (ύ)*/
+void journal_end()
+{
+    time_t now;
+    int due;
+    time(&now);
+    cache_lock();
+    due = ++journal_pending >= journal_batch || now - journal_last_commit >= JOURNAL_INTERVAL ||
+          bcache_count > BCACHE_SIZE; // 黺Ѿʱ߽ύһ񱻲
+    cache_unlock();
+    if (due) // ύʱҪӷܳл
+        journal_commit();
+}
+
+/*ʱط־ύطŵĿûпطŵύʱ 0*/
+int journal_recover()
+{
+    ext2_group_desc gd;
+    journal_header jh, ch;
+    char *blk;
+    int *tags;
+    int n, ndesc, i;
+    off_t start;
+    unsigned int sum = 2166136261u;
+
+    if (disk_pread(&gd, sizeof(gd), 0) != sizeof(gd) || gd.bg_magic != EXT2_GD_MAGIC || gd.bg_journal_blocks <= 0)
+        return 0; // ɸʽĴû־
+    start = (off_t)gd.bg_journal_block * blocksiz;
+    if (disk_pread(&jh, sizeof(jh), start) != sizeof(jh) || jh.h_magic != JOURNAL_MAGIC || jh.h_type != JOURNAL_DESCRIPTOR)
+        return 0;
+    n = jh.h_count;
+    ndesc = (n + JOURNAL_TAGS - 1) / JOURNAL_TAGS;
+    if (n <= 0 || ndesc + n + 1 > gd.bg_journal_blocks)
+        return 0;
+
+    blk = malloc((ndesc + n + 1) * blocksiz);
+    tags = malloc(n * sizeof(int));
+    if (disk_pread(blk, (size_t)(ndesc + n + 1) * blocksiz, start) != (ssize_t)(ndesc + n + 1) * blocksiz)
+        n = 0;
+    for (i = 0; i < n; i++)
+    {
+        tags[i] = ((int *)(blk + (i / JOURNAL_TAGS) * blocksiz + sizeof(journal_header)))[i % JOURNAL_TAGS];
+        sum = journal_checksum(sum, blk + (ndesc + i) * blocksiz, blocksiz);
+    }
+    memcpy(&ch, blk + (ndesc + n) * blocksiz, sizeof(ch));
+    if (n > 0 && ch.h_magic == JOURNAL_MAGIC && ch.h_type == JOURNAL_COMMIT && ch.h_seq == jh.h_seq &&
+        ch.h_count == n && ch.h_checksum == sum) // ύ˵ύд־
+    {
+        for (i = 0; i < n; i++)
+            disk_pwrite(blk + (ndesc + i) * blocksiz, blocksiz, (off_t)tags[i] * blocksiz);
+        disk_fsync();
+        journal_seq = jh.h_seq + 1;
+    }
+    else
+        n = 0; // ύ
+    free(blk);
+    free(tags);
+    gdt[0].bg_journal_block = gd.bg_journal_block;
+    journal_reset();
+    bcache_init(); // طǰľɿ
+    mcache_init();
+    return n;
+}
+
+/*Ƿ־ (ڴӳģʽ޸ֱӽӳ޷֤д˳򣬲)*/
+void journal_init()
+{
+    journal_active = disk_map == NULL && gdt[0].bg_magic == EXT2_GD_MAGIC && gdt[0].bg_journal_blocks > 0;
+    journal_pending = 0;
+    time(&journal_last_commit);
+}
+
+
+/*д̣ÿ˳ͼͷǰãڴӳģʽ·첽 msync
+  ־ʱֻǽһύʱд*/
+void bsync()
+{
+    int i;
+    if (disk_fd < 0)
+        return;
+    if (journal_active)
+    {
+        journal_end();
+        return;
+    }
+    icache_writeback(0); // ڵڵд뻺
+    alloc_flush(); // Ȱѳפλͼд뻺
+    if (disk_map != NULL)
+    {
+        msync(disk_map, disk_len, MS_ASYNC);
+        return;
+    }
+    cache_lock();
+    for (i = 0; i < bcache_count; i++)
+        if (bcache[i].b_blocknr != -1 && bcache[i].b_dirty)
+            bwrite_back(&bcache[i]);
+    cache_unlock();
+}
+
+/*ˢµ㣺д޸Ĳȴ䵽 (sync жʱ)*/
+void disk_flush()
+{
+    if (disk_fd < 0)
+        return;
+    if (journal_active) // ύύѾ
+    {
+        journal_commit();
+        return;
+    }
+    icache_writeback(1); // дȫڵ
+    bsync();
+    if (disk_map != NULL)
+        msync(disk_map, disk_len, MS_SYNC);
+    else
+        disk_fsync();
+}
+
+/*ӳ䵽ڴ棬ļΪʱֿ黺ģʽɹ 0*/
+int map_disk()
+{
+    struct stat st;
+    if (fstat(disk_fd, &st) != 0 || st.st_size == 0)
+        return 1;
+    disk_map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, disk_fd, 0);
+    if (disk_map == MAP_FAILED)
+    {
+        perror("mmap");
+        disk_map = NULL; // ӳʧʱ˻ؿ黺ģʽ
+        return 1;
+    }
+    disk_len = st.st_size;
+    return 0;
+}
+
+/*ڴӳ (̣߸ˢ)*/
+void unmap_disk()
+{
+    if (disk_map == NULL)
+        return;
+    munmap(disk_map, disk_len);
+    disk_map = NULL;
+    disk_len = 0;
+}
+
+/*̣ flags ΨһļӶռ (ѱ̹ʱȴ)տ黺档ɹ 0ļڷ 1*/
+int mount_disk(int flags)
+{
+    ra_drain();
+    disk_fd = open(PATH, flags, 0644);
+    if (disk_fd < 0)
+        return 1;
+    if (flock(disk_fd, LOCK_EX | LOCK_NB) != 0) // ͬһʱֻһ̹ (ļرջ˳ͷ)
+    {
+        fprintf(stderr, " %s ʹãȴ˳...\n", PATH);
+        while (flock(disk_fd, LOCK_EX) != 0 && errno == EINTR)
+            ;
+    }
+    __sync_fetch_and_add(&stats[stat_cur].opens, 1);
+    geometry_load(); // СĴС
+    dx_state_init();
+    bcache_init();
+    mcache_init();
+    icache_init();
+    if (mount_mmap)
+        map_disk();
+    return 0;
+}
+
+/*ж̣д޸ģӳ䲢رļ*/
+void umount_disk()
+{
+    if (disk_fd < 0)
+        return;
+    ra_drain(); // ̨̲߳ٷʿ黺ļ
+    disk_flush();
+    unmap_disk();
+    close(disk_fd);
+    disk_fd = -1;
+}
+
+/**********ڵ㻺**********/
+/**********ڵ㰴ŻڴУ޸ֻΪ࣬ڡsync жʱдڵ**********/
+#define ICACHE_SIZE 64         // ڵ㻺
+#define ICACHE_HASH 32         // ڵ㻺ϣͰ
+
+typedef struct inode_cache {
+    int i_ino;                   // ڵ (-1 ʾ)
+    int i_count;                 // üΪ 0 ʱᱻ̭
+    int i_dirty;                 // Ƿ޸Ĺ
+    ext2_inode i_data;           // ڵ
+    struct inode_cache *i_hnext; // ϣ
+    struct inode_cache *i_prev;  // LRU ǰ
+    struct inode_cache *i_next;  // LRU 
+} inode_cache;
+
+inode_cache icache[ICACHE_SIZE];
+inode_cache *ihash[ICACHE_HASH];
+inode_cache *ilru_head = NULL;
+inode_cache *ilru_tail = NULL;
+int inode_flush_interval = 5;    // ڵӳдص ( -i ָ0 ʾÿд)
+time_t inode_last_flush = 0;     // ϴдڵʱ
+
+/*ʼڵ㻺 (ʱ)*/
+void icache_init()
+{
+    int i;
+    for (i = 0; i < ICACHE_HASH; i++)
+        ihash[i] = NULL;
+    for (i = 0; i < ICACHE_SIZE; i++)
+    {
+        icache[i].i_ino = -1;
+        icache[i].i_count = 0;
+        icache[i].i_dirty = 0;
+        icache[i].i_hnext = NULL;
+        icache[i].i_prev = i > 0 ? &icache[i - 1] : NULL;
+        icache[i].i_next = i < ICACHE_SIZE - 1 ? &icache[i + 1] : NULL;
+    }
+    ilru_head = &icache[0];
+    ilru_tail = &icache[ICACHE_SIZE - 1];
+    time(&inode_last_flush);
+}
+
+/*ѻƶ LRU ͷ*/
+void ilru_touch(inode_cache *ic)
+{
+    if (ic == ilru_head)
+        return;
+    ic->i_prev->i_next = ic->i_next;
+    if (ic->i_next)
+        ic->i_next->i_prev = ic->i_prev;
+    else
+        ilru_tail = ic->i_prev;
+    ic->i_prev = NULL;
+    ic->i_next = ilru_head;
+    ilru_head->i_prev = ic;
+    ilru_head = ic;
+}
+
+/*ӹϣժд*/
+void ihash_remove(inode_cache *ic)
+{
+    inode_cache **p = &ihash[ic->i_ino % ICACHE_HASH];
+    if (ic->i_dirty)
+        disk_write(inode_pos(ic->i_ino), &ic->i_data, sizeof(ext2_inode));
+    while (*p != ic)
+        p = &(*p)->i_hnext;
+    *p = ic->i_hnext;
+    ic->i_ino = -1;
+    ic->i_dirty = 0;
+}
+
+/*ȡ ino ڵĻüδʱ̭δʹδõ iput*/
+inode_cache *iget(int ino)
+{
+    inode_cache *ic;
+    for (ic = ihash[ino % ICACHE_HASH]; ic != NULL; ic = ic->i_hnext)
+        if (ic->i_ino == ino)
+        {
+            ic->i_count++;
+            ilru_touch(ic);
+            return ic;
+        }
+
+    for (ic = ilru_tail; ic->i_count > 0; ic = ic->i_prev) // Աõ
+        ;
+    if (ic->i_ino != -1)
+        ihash_remove(ic);
+    ic->i_ino = ino;
+    ic->i_count = 1;
+    disk_read(inode_pos(ino), &ic->i_data, sizeof(ext2_inode));
+    ic->i_hnext = ihash[ino % ICACHE_HASH];
+    ihash[ino % ICACHE_HASH] = ic;
+    ilru_touch(ic);
+    return ic;
+}
+
+/*ͷ iget ȡõ*/
+void iput(inode_cache *ic)
+{
+    ic->i_count--;
+}
+
+void mark_inode_dirty(inode_cache *ic)
+{
+    ic->i_dirty = 1;
+}
+
+/*ȡ n ڵ㵽 buf*/
+void inode_read(int n, ext2_inode *buf)
+{
+    inode_cache *ic;
+    cache_lock();
+    ic = iget(n);
+    *buf = ic->i_data;
+    iput(ic);
+    cache_unlock();
+}
+
+/* node Ϊ n ڵ㣬ֻ޸Ļ沢Ϊ*/
+void inode_write(int n, const ext2_inode *node)
+{
+    inode_cache *ic;
+    cache_lock();
+    ic = iget(n);
+    ic->i_data = *node;
+    mark_inode_dirty(ic);
+    iput(ic);
+    cache_unlock();
+}
+
+/*ڵ㱻ͷź仺д*/
+void iforget(int n)
+{
+    inode_cache *ic;
+    cache_lock();
+    for (ic = ihash[n % ICACHE_HASH]; ic != NULL; ic = ic->i_hnext)
+        if (ic->i_ino == n)
+        {
+            ic->i_dirty = 0;
+            if (ic->i_count == 0)
+                ihash_remove(ic);
+            break;
+        }
+    cache_unlock();
+}
+
+/*ڵд黺棺force Ϊ 0 ʱֻھϴдس inode_flush_interval */
+void icache_writeback(int force)
+{
+    time_t now;
+    int i;
+    time(&now);
+    if (!force && now - inode_last_flush < inode_flush_interval)
+        return;
+    cache_lock();
+    for (i = 0; i < ICACHE_SIZE; i++)
+        if (icache[i].i_ino != -1 && icache[i].i_dirty)
+        {
+            disk_write(inode_pos(icache[i].i_ino), &icache[i].i_data, sizeof(ext2_inode));
+            icache[i].i_dirty = 0;
+        }
+    inode_last_flush = now;
+    cache_unlock();
+}
+
+/**********һ**********/
+/**********ʼģļϵͳ**********/
+
+/*ļϵͳжȡĿ¼ inode ݣ洢 cu ָָ ext2_inode ṹС*/
+int initialize(ext2_inode *cu)
+{
+    inode_read(0, cu); // ȡ 3 иĿ¼ inode  cu ָָĽṹ
+    return 0;
+}
+
+/*ûַʾݡ*/
+int getch() {
+    int ch; // ڱȡַ
+    struct termios oldt, newt; // ն˲ṹ壬ڱ޸ն
+
+    // ȡǰն˵Ĳã浽 `oldt` 
+    // STDIN_FILENO Ǳ׼루ļ 0
+    tcgetattr(STDIN_FILENO, &oldt);
+    // Ƶǰնõ `newt`׼޸
+    newt = oldt;
+    // ޸նã
+    // رջԣECHO: ַնʾ
+    // رչ淶ģʽICANONַҪ Enter ɶȡ
+    newt.c_lflag &= ~(ECHO | ICANON);
+    // ޸ĺĲЧնˣTCSANOW ʾЧ
+    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+    // ӱ׼ȡַ
+    ch = getchar();
+    // ָԭʼնãûԺ͹淶ģʽ
+    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    // ûַ
+    return ch;
+}
+
+/**********ģʽ**********/
+/**********ӽű׼ȡʹնԡʾȷϣÿĺʱ׼**********/
+int batch_mode = 0;  // ģʽ ( -B  -f ָ)
+int skip_login = 0;  // ¼ ( -n ָڲ)
+
+/*ģʽ Write Դжȡһ "." ʾ (൱ڽģʽµ ESC)*/
+int batch_getc()
+{
+    static char *line = NULL;
+    static size_t cap = 0;
+    static ssize_t len = 0, pos = 0;
+    if (pos >= len) // һȡ꣬һ
+    {
+        if ((len = getline(&line, &cap, stdin)) <= 0 || !strcmp(line, ".\n") || !strcmp(line, "."))
+        {
+            len = pos = 0;
+            return 27;
+        }
+        pos = 0;
+    }
+    return line[pos++];
+}
+
+/*ģʽ¶ǰеʣಿ (֮Ļ)*/
+void batch_skip_line()
+{
+    int ch;
+    while ((ch = getchar()) != EOF && ch != '\n')
+        ;
+}
+
+/*صʱӵĵǰʱ ()ڲ*/
+double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*˳ʾлϢ˳*/
+void exitdisplay()
+{
+    printf("лʹ~ ݰ\n");
+    return;
+}
+
+int format(ext2_inode *current, int bs, long long volume);
+void alloc_init();
+void dcache_init();
+/*ʼļϵͳ,ļϵͳʼɹ 0;ļϵͳʼʧܣ 1*/
+int initfs(ext2_inode *cu)
+{
+    int n;
+    if (mount_disk(O_RDWR) != 0 && batch_mode) // ģʽֱӴµļϵͳ
+    {
+        if (format(cu, format_blocksiz, format_volume) != 0)
+            return 1;
+    }
+    else if (disk_fd < 0) // ļϵͳļ
+    {
+        char ch; // ڴ洢û
+        int i;
+        printf("δҵļϵͳǷҪһµļϵͳ\n[Y/N]");
+        i = 1;
+        while (i) // ѭȴû
+        {
+            scanf("%c", &ch); // ȡû
+            switch (ch)
+            {
+            case 'Y':
+            case 'y': // ûѡ񴴽ļϵͳ
+                if (format(cu, format_blocksiz, format_volume) != 0) // ʽļϵͳ (ʽֹ̱)
+                    return 1; // ʽʧܣ 1
+                i = 0; // ֹͣѭ
+                break;
+            case 'N':
+            case 'n': // ûѡ񲻴ļϵͳ
+                exitdisplay(); // ʾ˳Ϣ
+                return 1; //  1ʾʼʧ
+            default:
+                printf("Ч\n"); // Чʾû
+                break;
+            }
+        }
+    }
+
+    else if ((n = journal_recover()) > 0) // ϴûжأط־ύ޸
+        printf("־ָ: ط %d \n", n);
+
+    // ļڣȡļϵͳϢ
+    disk_read(0, gdt, groups_count * sizeof(ext2_group_desc)); // ȡ
+    inode_read(0, &inode); // ȡĿ¼ڵ
+    alloc_init(); // 볣פڴλͼ
+    dcache_init();
+    journal_init();
+
+    initialize(cu); // ʼǰĿ¼
+    return 0; //  0ʾʼɹ
+}
+
+/**********λͼ**********/
+/**********λͼפڴ棬 64 λɨ裬άÿֵĿλժҪ**********/
+
+// פڴλͼλͼƴӣÿռ blocksiz*8 λ̸ʽΪ 32 λ飬ÿָλǰ ( 0 λΪ 0x80000000)
+typedef struct ext2_bitmap {
+    unsigned int *bits;              // λͼ (̸ʽͬ)
+    unsigned char *nfree;            // ÿ 64 λеĿλ
+    unsigned long long *nonfull;     //  w λΪ 1 ʾ w  64 λпλ
+    unsigned char *gdirty;           // ÿλͼǷҪдش
+    int kind;                        // 0: λͼ 1: ڵλͼ
+    int words;                       // 64 λ
+    int total;                       // λ
+    int dirty;                       // ǷλͼҪдش
+} ext2_bitmap;
+
+ext2_bitmap block_bitmap;  // λͼ
+ext2_bitmap inode_bitmap;  // ڵλͼ
+int desc_dirty = 0;        // ǷҪдش
+
+/*ȡ w  64 λ (ƴӣλǰ)*/
+unsigned long long bitmap_word(ext2_bitmap *bm, int w)
+{
+    return ((unsigned long long)bm->bits[2 * w] << 32) | bm->bits[2 * w + 1];
+}
+
+/*¼ w  64 λֵĿλժҪ*/
+void bitmap_summary(ext2_bitmap *bm, int w)
+{
+    bm->nfree[w] = 64 - __builtin_popcountll(bitmap_word(bm, w));
+    if (bm->nfree[w])
+        bm->nonfull[w / 64] |= 1ULL << (w % 64);
+    else
+        bm->nonfull[w / 64] &= ~(1ULL << (w % 64));
+}
+
+/* n λλͼҪд*/
+void bitmap_dirty(ext2_bitmap *bm, int n)
+{
+    bm->gdirty[n / (blocksiz * 8)] = 1;
+    bm->dirty = 1;
+}
+
+/*Ӹλͼÿ鳬ݿڵλΪ*/
+void bitmap_load(ext2_bitmap *bm, int kind)
+{
+    int g, i, per = blocksiz * 8;
+    bm->kind = kind;
+    bm->total = groups_count * per;
+    bm->words = bm->total / 64;
+    bm->bits = realloc(bm->bits, bm->total / 8);
+    bm->nfree = realloc(bm->nfree, bm->words);
+    bm->nonfull = realloc(bm->nonfull, (bm->words + 63) / 64 * sizeof(unsigned long long));
+    bm->gdirty = realloc(bm->gdirty, groups_count);
+    memset(bm->gdirty, 0, groups_count);
+    bm->dirty = 0;
+    for (g = 0; g < groups_count; g++)
+    {
+        disk_read(bitmap_block(g, kind) * blocksiz, bm->bits + g * (per / 32), blocksiz);
+        for (i = g * per + (kind ? inodes_per_group : group_blocks(g)); i < (g + 1) * per; i++) // ĩβЧλΪãʱᱻѡ
+            bm->bits[i / 32] |= 0x80000000u >> (i % 32);
+    }
+    memset(bm->nonfull, 0, (bm->words + 63) / 64 * sizeof(unsigned long long));
+    for (i = 0; i < bm->words; i++)
+        bitmap_summary(bm, i);
+}
+
+/*ص w ּ֮һпλ 64 λ±꣬û򷵻 -1*/
+int bitmap_next_nonfull(ext2_bitmap *bm, int w)
+{
+    int s = w / 64, nsum = (bm->words + 63) / 64;
+    unsigned long long m;
+    if (s >= nsum)
+        return -1;
+    m = bm->nonfull[s] & (~0ULL << (w % 64)); // ֮ǰ
+    while (!m)
+    {
+        if (++s >= nsum)
+            return -1;
+        m = bm->nonfull[s];
+    }
+    return s * 64 + __builtin_ctzll(m);
+}
+
+/* goal һλλţλͼ -1*/
+int bitmap_alloc(ext2_bitmap *bm, int goal)
+{
+    int w, k;
+    w = bitmap_next_nonfull(bm, goal / 64);
+    if (w < 0)
+        w = bitmap_next_nonfull(bm, 0); // Ƶλͼͷ
+    if (w < 0)
+        return -1;
+    k = __builtin_clzll(~bitmap_word(bm, w)); // ڵһ 0 λ
+    bm->bits[2 * w + k / 32] |= 0x80000000u >> (k % 32);
+    bitmap_summary(bm, w);
+    bitmap_dirty(bm, w * 64 + k);
+    return w * 64 + k;
+}
+
+/*ͷŵ n λλͿʱ -1 Ҳ޸*/
+int bitmap_free(ext2_bitmap *bm, int n)
+{
+    unsigned int mask = 0x80000000u >> (n % 32);
+    if (n < 0 || n >= bm->total || !(bm->bits[n / 32] & mask))
+        return -1;
+    bm->bits[n / 32] &= ~mask;
+    bitmap_summary(bm, n / 64);
+    bitmap_dirty(bm, n);
+    return 0;
+}
+
+/* n λʱ 1ʱ 0*/
+int bitmap_test(ext2_bitmap *bm, int n)
+{
+    return n >= 0 && n < bm->total && (bm->bits[n / 32] & (0x80000000u >> (n % 32))) != 0;
+}
+
+/********************/
+/**********ΪеļԤ鴰 ( ext4 Ԥ)**********/
+
+#define PREALLOC_BLOCKS 16     // ÿԤڵĿ
+#define PREALLOC_SLOTS 8       // ͬʱԤڵļ
+
+// ԤڣΪĳļԤռסһп (ֻڴλͼռãдλͼ)
+typedef struct prealloc_window {
+    int ino;       //  inode  (-1 ʾ)
+    int start;     // һÿ
+    int len;       // ʣ
+    int used;      // ʹõʱ (̭)
+} prealloc_window;
+
+prealloc_window pa_table[PREALLOC_SLOTS];
+int pa_clock = 0;          // Ԥڵʱ
+
+/* goal ʼѰ want λȫռãʼλţ*got Ϊʵʳȡ
+  ݿڴϲڣһλԽı߽*/
+int bitmap_alloc_run(ext2_bitmap *bm, int goal, int want, int *got)
+{
+    int pass, n, end, len, w;
+    int best = -1, best_len = 0;
+    for (pass = 0; pass < 2 && best_len < want; pass++) // ȴ goal ңٴͷҵ goal
+    {
+        n = pass == 0 ? goal : 0;
+        end = pass == 0 ? bm->total : goal;
+        while (n < end && best_len < want)
+        {
+            w = bitmap_next_nonfull(bm, n / 64); // 
+            if (w < 0 || w * 64 >= end)
+                break;
+            if (w * 64 > n)
+                n = w * 64;
+            if (bm->bits[n / 32] & (0x80000000u >> (n % 32)))
+            {
+                n++;
+                continue;
+            }
+            for (len = 1; n + len < end && len < want && (n + len) % (blocksiz * 8); len++) // ͳƴ n ʼĿλ
+                if (bm->bits[(n + len) / 32] & (0x80000000u >> ((n + len) % 32)))
+                    break;
+            if (len > best_len)
+            {
+                best = n;
+                best_len = len;
+            }
+            n += len;
+        }
+    }
+    if (best < 0)
+        return -1;
+    for (n = best; n < best + best_len; n++)
+    {
+        bm->bits[n / 32] |= 0x80000000u >> (n % 32);
+        if (n % 64 == 63 || n == best + best_len - 1)
+            bitmap_summary(bm, n / 64);
+    }
+    bitmap_dirty(bm, best);
+    *got = best_len;
+    return best;
+}
+
+/*ͷ ino ԤδĿ (ino Ϊ -1 ʱͷȫ)*/
+void prealloc_discard(int ino)
+{
+    int i, n;
+    alloc_lock();
+    for (i = 0; i < PREALLOC_SLOTS; i++)
+        if (pa_table[i].len > 0 && (ino == -1 || pa_table[i].ino == ino))
+        {
+            for (n = pa_table[i].start; n < pa_table[i].start + pa_table[i].len; n++)
+                bitmap_free(&block_bitmap, n);
+            pa_table[i].len = 0;
+            pa_table[i].ino = -1;
+        }
+    alloc_unlock();
+}
+
+void count_blocks(int n, int delta);
+
+/*Ϊ ino ļһݿ飬ʹԤڣgoal ΪĿ (ͨһ)*/
+int FindBlockNear(int ino, int goal)
+{
+    stat_ctx sc = stat_enter(STAT_FINDBLOCK);
+    int i, slot = -1, got, n;
+    alloc_lock();
+    for (i = 0; i < PREALLOC_SLOTS; i++)
+        if (pa_table[i].ino == ino && pa_table[i].len > 0)
+        {
+            slot = i;
+            break;
+        }
+    if (slot < 0) // ûпôʱԤ̭δõĴ
+    {
+        slot = 0;
+        for (i = 1; i < PREALLOC_SLOTS; i++)
+            if (pa_table[i].len == 0 || (pa_table[slot].len > 0 && pa_table[i].used < pa_table[slot].used))
+                slot = i;
+        if (pa_table[slot].len > 0)
+            prealloc_discard(pa_table[slot].ino);
+        n = bitmap_alloc_run(&block_bitmap, goal < 0 ? inode_group(ino) * blocks_per_group : goal, PREALLOC_BLOCKS, &got); // ׿ڵڵ
+        if (n < 0)
+        {
+            alloc_unlock();
+            return stat_leave(&sc, -1); // ûпп
+        }
+        pa_table[slot].ino = ino;
+        pa_table[slot].start = n;
+        pa_table[slot].len = got;
+    }
+    n = pa_table[slot].start++;
+    pa_table[slot].len--;
+    pa_table[slot].used = ++pa_clock;
+    bitmap_dirty(&block_bitmap, n); // ÿӴдλͼ
+    count_blocks(n, -1); // ʹʱż
+    last_allco_block = n;
+    alloc_unlock();
+    return stat_leave(&sc, n);
+}
+
+/*Ӽдش̵ĵ g λͼԤδʹõĿ*/
+void prealloc_mask(unsigned int *bits, int g)
+{
+    int i, n;
+    for (i = 0; i < PREALLOC_SLOTS; i++)
+        for (n = pa_table[i].start; n < pa_table[i].start + pa_table[i].len; n++)
+            if (n / blocks_per_group == g)
+                bits[n % blocks_per_group / 32] &= ~(0x80000000u >> (n % 32));
+}
+
+/*ػʽλͼ*/
+void alloc_init()
+{
+    int i;
+    bitmap_load(&block_bitmap, 0);
+    bitmap_load(&inode_bitmap, 1);
+    desc_dirty = 0;
+    for (i = 0; i < PREALLOC_SLOTS; i++) // Ԥ
+    {
+        pa_table[i].ino = -1;
+        pa_table[i].len = 0;
+    }
+}
+
+/*޸Ĺĸλͼдأÿʱ bsync һ*/
+void alloc_flush()
+{
+    unsigned int bits[blocksiz / 4];
+    int g;
+    alloc_lock();
+    for (g = 0; block_bitmap.dirty && g < groups_count; g++)
+        if (block_bitmap.gdirty[g])
+        {
+            memcpy(bits, block_bitmap.bits + g * (blocksiz / 4), blocksiz);
+            prealloc_mask(bits, g); // ԤֻռڴλͼԼΪ
+            disk_write(bitmap_block(g, 0) * blocksiz, bits, blocksiz);
+            block_bitmap.gdirty[g] = 0;
+        }
+    block_bitmap.dirty = 0;
+    for (g = 0; inode_bitmap.dirty && g < groups_count; g++)
+        if (inode_bitmap.gdirty[g])
+        {
+            disk_write(bitmap_block(g, 1) * blocksiz, inode_bitmap.bits + g * (blocksiz / 4), blocksiz);
+            inode_bitmap.gdirty[g] = 0;
+        }
+    inode_bitmap.dirty = 0;
+    if (desc_dirty)
+    {
+        disk_write_cached(0, gdt, groups_count * sizeof(ext2_group_desc)); // ʱ飬ҲҪд־
+        desc_dirty = 0;
+    }
+    alloc_unlock();
+}
+
+/*ݿ n ռ (delta Ϊ) ͷ (delta Ϊ) Ŀп*/
+void count_blocks(int n, int delta)
+{
+    gdt[n / blocks_per_group].bg_free_blocks_count += delta;
+    desc_dirty = 1;
+}
+
+/*ڵ n ռûͷźĿڵ*/
+void count_inodes(int n, int delta)
+{
+    gdt[inode_group(n)].bg_free_inodes_count += delta;
+    desc_dirty = 1;
+}
+
+/*Ŀп*/
+long free_blocks_total()
+{
+    long sum = 0;
+    int g;
+    for (g = 0; g < groups_count; g++)
+        sum += gdt[g].bg_free_blocks_count;
+    return sum;
+}
+
+/*ino ļηʱõĿпԤеĿ鲻ֻдڵ (alloc_file_blocks ͷԼĴ)*/
+long free_blocks_avail(int ino)
+{
+    long sum;
+    int i;
+    alloc_lock();
+    sum = free_blocks_total();
+    for (i = 0; i < PREALLOC_SLOTS; i++)
+        if (pa_table[i].len > 0 && pa_table[i].ino != ino)
+            sum -= pa_table[i].len;
+    alloc_unlock();
+    return sum;
+}
+
+/*ΪĿ¼ѡ飺ڿڵ㲻ƽֵѡĿ¼ٵģĿ¼ɢ飬ظĵһڵ*/
+int find_group_dir()
+{
+    long sum = 0;
+    int g, best = -1;
+    for (g = 0; g < groups_count; g++)
+        sum += gdt[g].bg_free_inodes_count;
+    for (g = 0; g < groups_count; g++)
+        if (gdt[g].bg_free_inodes_count > 0 && (long)gdt[g].bg_free_inodes_count * groups_count >= sum &&
+            (best < 0 || gdt[g].bg_used_dirs_count < gdt[best].bg_used_dirs_count))
+            best = g;
+    return (best < 0 ? 0 : best) * blocksiz * 8;
+}
+
+/**********ڶ**********/
+/**********ļϵͳӺ**********/
+
+/*䵽ڵ n ʱδڵڣѸƵ n ֮
+  ʽʱ̱ضϺչһļնΪ㣬Ҫд롣߳з*/
+void itable_mark(int n)
+{
+    ext2_group_desc *gd = &gdt[inode_group(n)];
+    int k = n % (blocksiz * 8);
+    if (!(gd->bg_flags & EXT2_BG_ITABLE_UNINIT) || k < inodes_per_group - gd->bg_itable_unused)
+        return;
+    gd->bg_itable_unused = inodes_per_group - (k + 1);
+    if (gd->bg_itable_unused == 0)
+        gd->bg_flags &= ~EXT2_BG_ITABLE_UNINIT;
+    desc_dirty = 1;
+}
+
+/* goal Ÿҿڵ*/
+int FindInode(int goal)
+{
+    stat_ctx sc = stat_enter(STAT_FINDINODE);
+    int n;
+    alloc_lock();
+    n = bitmap_alloc(&inode_bitmap, goal);
+    if (n >= 0) // n < 0 ʾûпinode
+    {
+        count_inodes(n, -1); // Ŀinode
+        itable_mark(n);       // Сδڵ
+        last_allco_inode = n; // ¼inode
+    }
+    alloc_unlock();
+    return stat_leave(&sc, n);
+}
+
+/*ҿп*/
+int FindBlock()
+{
+    stat_ctx sc = stat_enter(STAT_FINDBLOCK);
+    int n;
+    alloc_lock();
+    n = bitmap_alloc(&block_bitmap, last_allco_block);
+    if (n >= 0) // n < 0 ʾûпп
+    {
+        count_blocks(n, -1); // Ŀп
+        last_allco_block = n; // ¼Ŀ
+    }
+    alloc_unlock();
+    return stat_leave(&sc, n);
+}
+
+// ɾָ inode ڵ㣬 inode λͼ
+void DelInode(int len) // len  inode 
+{
+    alloc_lock();
+    if (bitmap_free(&inode_bitmap, len) != 0) // ظͷʱٷתλ
+        printf(": inode %d ǿе\n", len);
+    else
+    {
+        count_inodes(len, 1);
+        iforget(len); // ͷŵڵ㲻д
+    }
+    alloc_unlock();
+}
+
+// ɾָݿ飬¿λͼ
+void DelBlock(int len)
+{
+    map_forget(len);
+    alloc_lock();
+    if (bitmap_free(&block_bitmap, len) != 0) // ظͷʱٷתλ
+        printf(": ݿ %d ǿе\n", len);
+    else
+        count_blocks(len, 1);
+    alloc_unlock();
+}
+
+//  i_pad м¼ϢֽΪ EXT2_PAD_EXTENT ʱЧ (Create  i_pad Ϊ 0xff)
+#define EXT2_PAD_EXTENT 0x01   // i_pad бα
+#define EXT2_MAX_EXTENTS 4     // i_pad ౣ
+
+typedef struct ext2_extent {
+    unsigned short ee_block; // εʼ߼
+    unsigned short ee_len;   // γ ()
+    int ee_start;            // εʼݿ
+} ext2_extent;
+
+typedef struct ext2_extent_header {
+    unsigned char eh_magic;                  // EXT2_PAD_EXTENT
+    unsigned char eh_entries;                // ʹõ
+    unsigned short eh_pad;
+    ext2_extent eh_ext[EXT2_MAX_EXTENTS];    // ߼ŵе
+} ext2_extent_header;                        //  36 ֽڣǡռ i_pad
+
+/*ļ߼ i -> ݿ j ααд󣬺ֻ¼ i_block */
+void extent_add(ext2_inode *current, int i, int j)
+{
+    ext2_extent_header *eh = (ext2_extent_header *)current->i_pad;
+    ext2_extent *last;
+    if (current->i_mode != 1) // ֻΪͨļά
+        return;
+    if (i == 0) // ļĵһ飺ʼα
+    {
+        memset(eh, 0, sizeof(ext2_extent_header));
+        eh->eh_magic = EXT2_PAD_EXTENT;
+    }
+    if (eh->eh_magic != EXT2_PAD_EXTENT || i > 0xffff)
+        return;
+    last = eh->eh_entries ? &eh->eh_ext[eh->eh_entries - 1] : NULL;
+    if (last && last->ee_block + last->ee_len == i && last->ee_start + last->ee_len == j && last->ee_len < 0xffff &&
+        j % blocks_per_group) // ߽Ŀڴϲ
+        last->ee_len++; // һֱӳ
+    else if (eh->eh_entries < EXT2_MAX_EXTENTS && (!last || last->ee_block + last->ee_len == i))
+    {
+        last = &eh->eh_ext[eh->eh_entries++];
+        last->ee_block = i;
+        last->ee_len = 1;
+        last->ee_start = j;
+    }
+}
+
+/*ͨα߼ lblkݿţ*run ΪӸÿ鿪ʼδʱ -1*/
+int extent_lookup(ext2_inode *node, int lblk, int *run)
+{
+    ext2_extent_header *eh = (ext2_extent_header *)node->i_pad;
+    int k;
+    if (eh->eh_magic != EXT2_PAD_EXTENT)
+        return -1;
+    for (k = 0; k < eh->eh_entries && k < EXT2_MAX_EXTENTS; k++)
+        if (lblk >= eh->eh_ext[k].ee_block && lblk < eh->eh_ext[k].ee_block + eh->eh_ext[k].ee_len)
+        {
+            if (run)
+                *run = eh->eh_ext[k].ee_block + eh->eh_ext[k].ee_len - lblk;
+            return eh->eh_ext[k].ee_start + (lblk - eh->eh_ext[k].ee_block);
+        }
+    return -1;
+}
+
+// СļֱӱڵУi_pad ֽΪ EXT2_PAD_INLINE ʱЧ
+// ļ i_blocks Ϊ 0ӳò i_blockδ i_block (32 ֽ)  i_pad[1..35] 
+#define EXT2_PAD_INLINE 0x03   // ļڵ
+#define EXT2_INLINE_MAX 67     // ݵֽ
+
+#define inline_valid(node) ((node)->i_mode == 1 && (node)->i_pad[0] == EXT2_PAD_INLINE)
+
+/*ݵ off  len ֽڵ buf (write Ϊ 0) buf дô (write Ϊ 1)*/
+void inline_copy(ext2_inode *node, int off, char *buf, int len, int write)
+{
+    char *p;
+    int k;
+    for (k = 0; k < len; k++, off++)
+    {
+        p = off < (int)sizeof(node->i_block) ? (char *)node->i_block + off : node->i_pad + 1 + (off - sizeof(node->i_block));
+        if (write)
+            *p = buf[k];
+        else
+            buf[k] = *p;
+    }
+}
+
+// ӳеĿ 0 ʾն (0 ݿǸĿ¼ĵһ飬ļ)ȫ㣬ռݿ顣
+// ߼ i_blocks ֮ǿնⲿֵӳָǽضϻɰ汾µĲֵ i_blocks ʱ
+
+/* blk е from  to-1 */
+void zero_entries(int blk, int from, int to)
+{
+    if (blk != 0 && from < to)
+        map_set(blk, from, to, NULL);
+}
+
+/*һ鲢 (бǿն)ûппʱ -1*/
+int new_index_block()
+{
+    int b = FindBlock();
+    if (b >= 0)
+        zero_entries(b, 0, blocksiz / sizeof(int));
+    return b;
+}
+
+/*ļӳ䳤 i_blocks  m¸ǵ߼鶼ǿն*/
+void map_extend(ext2_inode *node, int m)
+{
+    int ptrs = blocksiz / sizeof(int);
+    int n = node->i_blocks, l, first, last, a;
+    if (m <= n)
+        return;
+    for (l = n; l < 6 && l < m; l++) // ֱ
+        node->i_block[l] = 0;
+    if (m > 6) // һ
+    {
+        if (n <= 6)
+            node->i_block[6] = 0; // һδʹ
+        else if (n < 6 + ptrs)
+            zero_entries(node->i_block[6], n - 6, m - 6 < ptrs ? m - 6 : ptrs);
+    }
+    if (m > 6 + ptrs) // 
+    {
+        if (n <= 6 + ptrs)
+        {
+            node->i_block[7] = 0; // δʹ
+            node->i_blocks = m;
+            return;
+        }
+        first = n - 6 - ptrs; // Χ [first, last) Ϊն
+        last = m - 6 - ptrs;
+        if (node->i_block[7] == 0)
+        {
+            node->i_blocks = m;
+            return;
+        }
+        if (first % ptrs) // һʣı
+        {
+            a = map_get(node->i_block[7], first / ptrs);
+            zero_entries(a, first % ptrs, last - first / ptrs * ptrs < ptrs ? last - first / ptrs * ptrs : ptrs);
+        }
+        zero_entries(node->i_block[7], (first + ptrs - 1) / ptrs, (last + ptrs - 1) / ptrs); // δʹõı
+    }
+    node->i_blocks = m;
+}
+
+// һݿ鵽ǰļУֱ֧һͶi С i_blocks ʱͬʱӳ䳤ȡ
+// ɹ 0ʱռ䲻㷵 1ʱļӳ䱣ֲ䣬ݿ j ɵ߸ͷ
+int add_block(ext2_inode *current, int i, int j) // i ʾݿţj ·ݿ
+{
+    int ptrs = blocksiz / sizeof(int); // ÿɴŵĿ
+    int lblk = i, old_blocks = current->i_blocks;
+    int a, top = 0;
+
+    map_extend(current, i + 1);
+    if (i < 6) // ʹֱ
+    {
+        current->i_block[i] = j; // ݿֱд i_block 
+        extent_add(current, lblk, j);
+        return 0;
+    }
+    i = i - 6; // żȥֱ
+    if (i < ptrs) // һ
+    {
+        if (current->i_block[6] == 0) // Ϊһ
+        {
+            if ((a = new_index_block()) < 0)
+                goto nospace;
+            current->i_block[6] = a;
+        }
+        map_set(current->i_block[6], i, i + 1, &j); // дӦݿ
+        extent_add(current, lblk, j);
+        return 0;
+    }
+    i = i - ptrs; // żȥһ
+    if (current->i_block[7] == 0) // Ϊ䶥
+    {
+        if ((top = new_index_block()) < 0)
+            goto nospace;
+        current->i_block[7] = top;
+    }
+    a = map_get(current->i_block[7], i / ptrs);
+    if (a == 0) // ҪµĶ
+    {
+        if ((a = new_index_block()) < 0)
+        {
+            if (top > 0) // ηĶ
+            {
+                current->i_block[7] = 0;
+                DelBlock(top);
+            }
+            goto nospace;
+        }
+        map_set(current->i_block[7], i / ptrs, i / ptrs + 1, &a);
+    }
+    map_set(a, i % ptrs, i % ptrs + 1, &j); // дݿ
+    extent_add(current, lblk, j);
+    return 0;
+nospace:
+    current->i_blocks = old_blocks; // ıǿն˻ԭӳ䳤ȼ
+    return 1;
+}
+
+// ļ߼ lblk ӳΪݿţȲαٲӳ仺еļ
+int bmap(ext2_inode *node, int lblk)
+{
+    int ptrs = blocksiz / sizeof(int);
+    int a;
+
+    if (lblk >= node->i_blocks) // ӳ䷶Χ֮ǿն
+        return 0;
+    if ((a = extent_lookup(node, lblk, NULL)) >= 0) // α
+        return a;
+    if (lblk < 6) // ֱ
+        return node->i_block[lblk];
+    lblk -= 6;
+    if (lblk < ptrs) // һ鲻ʱζǿն
+    {
+        if (node->i_block[6] == 0)
+            return 0;
+        return map_get(node->i_block[6], lblk);
+    }
+    lblk -= ptrs; // 
+    if (node->i_block[7] == 0 || (a = map_get(node->i_block[7], lblk / ptrs)) == 0)
+        return 0;
+    return map_get(a, lblk % ptrs);
+}
+
+// Ŀ¼Ĵ洢λƫÿĿ¼ռ 32 ֽ
+off_t dir_entry_position(int dir_entry_begin, ext2_inode *node) // dir_entry_begin ʾĿ¼ʼֽ
+{
+    int dir_blocks = dir_entry_begin / blocksiz;   // Ŀ¼ڵ߼
+    int block_offset = dir_entry_begin % blocksiz; // ǰڵֽƫ
+    return block_pos(bmap(node, dir_blocks)) + block_offset;
+}
+
+// ͨļеĿ 0 ǿն (Ŀ¼пնĿ¼ĵһ 0 ݿ)
+#define is_hole(node, b) ((b) == 0 && (node)->i_mode == 1)
+
+// ߼ lblk Ӧݿţ*run ΪӸÿ鿪ʼĿ ( max)ն 0*run ΪĿն
+int bmap_run(ext2_inode *node, int lblk, int max, int *run)
+{
+    int start = extent_lookup(node, lblk, run);
+    if (start >= 0) // αֱӸ
+    {
+        if (*run > max)
+            *run = max;
+        return start;
+    }
+    start = bmap(node, lblk);
+    if (is_hole(node, start))
+    {
+        for (*run = 1; *run < max && bmap(node, lblk + *run) == 0; (*run)++)
+            ;
+        return 0;
+    }
+    for (*run = 1; *run < max && (start + *run) % blocks_per_group && bmap(node, lblk + *run) == start + *run; (*run)++)
+        ;
+    return start;
+}
+
+/**********Ԥ**********/
+/**********ļ˳ʣɺ̨ I/O ߳ǰĿ飺Ŀ¼黺棬
+  ļݽںԤ (ζȡ黺)ڴӳģʽ madvise ʾں**********/
+#define RA_SLOTS 16            // ͬʱٵļ
+#define RA_MIN 4               // ʼԤ ()
+#define RA_MAX 32              // Ԥ ()
+#define RA_QUEUE 64            // ̵̨߳г
+
+// һļ˳״̬
+typedef struct ra_state {
+    int key;                   // ļڵ (-1 ʾ)
+    int next;                  // ˳ʱһӦʵ߼
+    int end;                   // ѷԤ߼Ͻ
+    int win;                   // һԤĿ0 ʾδжΪ˳
+    int used;                  // һηʵʱ
+} ra_state;
+
+// ̵̨߳ԤһĿ
+typedef struct ra_request {
+    int blocknr;               // ʼ (еľԿ)
+    int count;                 // 
+    int cache;                 // 1: 黺, 0: ֻںԤ
+} ra_request;
+
+ra_state ra_table[RA_SLOTS];
+ra_request ra_queue[RA_QUEUE];
+int ra_head = 0, ra_tail = 0;  // еȡͷλ
+int ra_busy = 0;               // ̨߳ڴ
+int ra_clock = 0;              // ʱ
+int ra_started = 0;            // ̨߳
+int ra_enabled = 1;            // ǷԤ ( -R ر)
+pthread_t ra_thread;
+pthread_mutex_t ra_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ra_wakeup = PTHREAD_COND_INITIALIZER; // 
+pthread_cond_t ra_idle = PTHREAD_COND_INITIALIZER;   // Ѵ
+
+/*ѴӾԿ first ʼ count 黺 (̵̨߳)ѻĿ鱣ֲ䣻
+  ȡڼдʱݿѹʱζֻ̭ɾĿ飬ΪԤ־ύ*/
+void bcache_prefetch(int first, int count)
+{
+    char *buf = malloc((size_t)count * blocksiz);
+    buffer_head *bh;
+    long seq;
+    int i;
+    cache_lock();
+    seq = disk_writes_begun;
+    i = seq != disk_writes_done; // дڽ
+    cache_unlock();
+    if (!i)
+    {
+        disk_pread(buf, (size_t)count * blocksiz, (off_t)first * blocksiz);
+        cache_lock();
+        for (i = 0; i < count && __sync_fetch_and_add(&disk_writes_begun, 0) == seq; i++)
+        {
+            for (bh = bhash[(first + i) % BCACHE_HASH]; bh != NULL && bh->b_blocknr != first + i; bh = bh->b_hnext)
+                ;
+            if (bh != NULL)
+                continue;
+            for (bh = lru_tail; bh != NULL && bh->b_blocknr != -1 && bh->b_dirty; bh = bh->b_prev)
+                ;
+            if (bh == NULL)
+                break;
+            if (bh->b_blocknr != -1)
+                bhash_remove(bh);
+            bh->b_blocknr = first + i;
+            bh->b_dirty = 0;
+            memcpy(bh->b_data, buf + (size_t)i * blocksiz, blocksiz);
+            bh->b_hnext = bhash[bh->b_blocknr % BCACHE_HASH];
+            bhash[bh->b_blocknr % BCACHE_HASH] = bh;
+            lru_touch(bh);
+        }
+        cache_unlock();
+    }
+    free(buf);
+}
+
+/*̨ I/O ̣߳δԤ*/
+void *ra_worker(void *arg)
+{
+    ra_request rq;
+    pthread_mutex_lock(&ra_mutex);
+    for (;;)
+    {
+        while (ra_head == ra_tail)
+            pthread_cond_wait(&ra_wakeup, &ra_mutex);
+        rq = ra_queue[ra_head % RA_QUEUE];
+        ra_head++;
+        ra_busy = 1;
+        pthread_mutex_unlock(&ra_mutex);
+        if (rq.cache)
+            bcache_prefetch(rq.blocknr, rq.count);
+        else
+            posix_fadvise(disk_fd, (off_t)rq.blocknr * blocksiz, (off_t)rq.count * blocksiz, POSIX_FADV_WILLNEED);
+        pthread_mutex_lock(&ra_mutex);
+        ra_busy = 0;
+        if (ra_head == ra_tail)
+            pthread_cond_broadcast(&ra_idle);
+    }
+    return arg;
+}
+
+/*ȴ̴̨߳󣬲ոļķ״̬ (غжʱ)*/
+void ra_drain()
+{
+    int i;
+    pthread_mutex_lock(&ra_mutex);
+    while (ra_head != ra_tail || ra_busy)
+        pthread_cond_wait(&ra_idle, &ra_mutex);
+    for (i = 0; i < RA_SLOTS; i++)
+        ra_table[i].key = -1;
+    pthread_mutex_unlock(&ra_mutex);
+}
+
+/*ύļ node ߼ [from, to) Ԥڵн (Ҫļ֮)
+  Ķν̨̣߳ʱ*/
+void ra_submit(ext2_inode *node, int from, int to)
+{
+    sigset_t all, old;
+    long page;
+    off_t pos, len;
+    int l, run, start;
+    for (l = from; l < to; l += run)
+    {
+        start = bmap_run(node, l, to - l, &run);
+        if (is_hole(node, start))
+            continue;
+        pos = block_pos(start);
+        if (disk_map != NULL) // ڴӳģʽں첽
+        {
+            page = sysconf(_SC_PAGESIZE);
+            len = (off_t)run * blocksiz + pos % page;
+            madvise(disk_map + pos - pos % page, len, MADV_WILLNEED);
+            continue;
+        }
+        pthread_mutex_lock(&ra_mutex);
+        if (!ra_started) // һԤʱ̨̣߳ź
+        {
+            sigfillset(&all);
+            pthread_sigmask(SIG_SETMASK, &all, &old);
+            ra_started = pthread_create(&ra_thread, NULL, ra_worker, NULL) == 0;
+            pthread_sigmask(SIG_SETMASK, &old, NULL);
+            if (ra_started)
+                pthread_detach(ra_thread);
+        }
+        if (ra_started && ra_tail - ra_head < RA_QUEUE)
+        {
+            ra_queue[ra_tail % RA_QUEUE].blocknr = (int)(pos / blocksiz);
+            ra_queue[ra_tail % RA_QUEUE].count = run;
+            ra_queue[ra_tail % RA_QUEUE].cache = node->i_mode == 2;
+            ra_tail++;
+            pthread_cond_signal(&ra_wakeup);
+        }
+        pthread_mutex_unlock(&ra_mutex);
+    }
+}
+
+/*߼˳ ino ļ node Ŀ [lblk, lblk+n)ϴηʵλʱжΪ˳ʣ
+  ԤĲõһһڣڴ RA_MIN ÿμӱ RA_MAX  (ҲڱηʵĿ)*/
+void readahead(ext2_inode *node, int ino, int lblk, int n)
+{
+    ra_state *ra = NULL;
+    int k, total, from = 0, to = 0, win;
+    if (!ra_enabled || inline_valid(node) || (node->i_mode == 1 && n >= RA_MAX))
+        return; // ζȡһδ preadں˶ļ˳ȡԤ
+    total = node->i_mode == 2 ? node->i_blocks : (node->i_size + blocksiz - 1) / blocksiz;
+    if (total <= RA_MIN) // СļԤ
+        return;
+    pthread_mutex_lock(&ra_mutex);
+    for (k = 0; k < RA_SLOTS; k++)
+        if (ra_table[k].key == ino)
+        {
+            ra = &ra_table[k];
+            break;
+        }
+        else if (ra == NULL || ra_table[k].used < ra->used) // δõĲ
+            ra = &ra_table[k];
+    if (ra->key != ino)
+    {
+        ra->key = ino;
+        ra->next = -2;
+    }
+    ra->used = ++ra_clock;
+    if (lblk < ra->next - 1 || lblk > ra->next) //  (ٴηϴεһ)
+    {
+        ra->win = 0;
+        ra->end = lblk + n;
+    }
+    else if (ra->end - (lblk + n) < (ra->win > n ? ra->win : n) / 2)
+    {
+        if (ra->win == 0)
+            ra->win = RA_MIN;
+        win = ra->win > n ? ra->win : n;
+        from = ra->end > lblk + n ? ra->end : lblk + n;
+        to = from + win < total ? from + win : total;
+        if (to > ra->end)
+            ra->end = to;
+        if (ra->win < RA_MAX)
+            ra->win *= 2;
+    }
+    ra->next = lblk + n;
+    pthread_mutex_unlock(&ra_mutex);
+    if (from < to)
+        ra_submit(node, from, to);
+}
+
+//  ino ļ offset ȡ len ֽڵ bufÿ߼ֻһΣĿϲΪһζȡնֱ㣬ضȡֽ
+int read_file(ext2_inode *node, int ino, int offset, char *buf, int len)
+{
+    int done = 0, pos, off, run, start, n;
+    if (offset >= node->i_size)
+        return 0;
+    if (len > node->i_size - offset)
+        len = node->i_size - offset;
+    if (inline_valid(node)) // ݾڵУݿ
+    {
+        inline_copy(node, offset, buf, len, 0);
+        return len;
+    }
+    readahead(node, ino, offset / blocksiz, (offset + len - 1) / blocksiz - offset / blocksiz + 1);
+    while (done < len)
+    {
+        pos = offset + done;
+        off = pos % blocksiz; // ֻеһܲӿ׿ʼ
+        start = bmap_run(node, pos / blocksiz, (off + len - done + blocksiz - 1) / blocksiz, &run);
+        n = run * blocksiz - off;
+        if (n > len - done)
+            n = len - done;
+        if (is_hole(node, start))
+            memset(buf + done, 0, n);
+        else
+            disk_read(block_pos(start) + off, buf + done, n);
+        done += n;
+    }
+    return done;
+}
+
+/* ino ļĩβ׷ǰãһֻдһǿնʱ (ļ)ΪһĿ顣
+  ɹ 0ռ䲻㷵 1*/
+int fill_tail(ext2_inode *node, int ino)
+{
+    char *zero;
+    int b, goal;
+    if (node->i_size % blocksiz == 0 || bmap(node, node->i_size / blocksiz) != 0)
+        return 0;
+    goal = node->i_size / blocksiz > 0 ? bmap(node, node->i_size / blocksiz - 1) : 0;
+    if ((b = FindBlockNear(ino, goal > 0 ? goal + 1 : -1)) < 0)
+        return 1;
+    if (add_block(node, node->i_size / blocksiz, b))
+    {
+        DelBlock(b);
+        return 1;
+    }
+    zero = calloc(1, blocksiz);
+    disk_write(block_pos(b), zero, blocksiz);
+    free(zero);
+    return 0;
+}
+
+/*ļҪ size ֽʱãļ size  EXT2_INLINE_MAX ʱΪ洢
+  ļʱƵһݿСɹ 0ռ䲻㷵 1*/
+int inline_prepare(ext2_inode *node, int ino, int size)
+{
+    char *buf;
+    int b;
+    if (!inline_valid(node))
+    {
+        if (node->i_mode == 1 && node->i_size == 0 && node->i_blocks == 0 && size <= EXT2_INLINE_MAX)
+            node->i_pad[0] = EXT2_PAD_INLINE;
+        return 0;
+    }
+    if (size <= EXT2_INLINE_MAX)
+        return 0;
+    if (node->i_size > 0)
+    {
+        if ((b = FindBlockNear(ino, -1)) < 0)
+            return 1;
+        buf = calloc(1, blocksiz);
+        inline_copy(node, 0, buf, node->i_size, 0);
+        node->i_pad[0] = (char)0xff;
+        if (add_block(node, 0, b)) // ͬʱα i_block е
+        {
+            node->i_pad[0] = EXT2_PAD_INLINE;
+            inline_copy(node, 0, buf, node->i_size, 1); // map_extend  i_block е
+            free(buf);
+            DelBlock(b);
+            return 1;
+        }
+        disk_write(block_pos(b), buf, blocksiz);
+        free(buf);
+    }
+    else
+        node->i_pad[0] = (char)0xff;
+    return 0;
+}
+
+// Ϊ ino ļһԷ߼ [from, to)ݿ飬 0 ʾɹռ䲻㷵 1
+int alloc_file_blocks(ext2_inode *node, int ino, int from, int to)
+{
+    int l = from, n, got, k;
+    int goal;
+    if (inline_valid(node)) // Կ (Ѿ inline_prepare )
+        return 0;
+    if (to > 6 + blocksiz / 4 + (blocksiz / 4) * (blocksiz / 4)) // ܱʾķΧ
+        return 1;
+    goal = from > 0 ? bmap(node, from - 1) : 0;
+    if ((long long)from * blocksiz >= node->i_size && fill_tail(node, ino)) // ļĩβ׷
+        return 1;
+    goal = goal > 0 ? goal + 1 : inode_group(ino) * blocks_per_group; // ׿ڵڵ
+    prealloc_discard(ino); // ηʱҪԤ
+    while (l < to)
+    {
+        alloc_lock();
+        n = bitmap_alloc_run(&block_bitmap, goal, to - l, &got);
+        if (n >= 0)
+        {
+            count_blocks(n, -got);
+            last_allco_block = n + got - 1;
+        }
+        alloc_unlock();
+        if (n < 0)
+            return 1; // ûпп
+        for (k = 0; k < got; k++, l++) //  add_block з
+            if (add_block(node, l, n + k))
+            {
+                for (; k < got; k++) // ͷŻûӳļĿ
+                    DelBlock(n + k);
+                return 1;
+            }
+        goal = n + got;
+    }
+    return 0;
+}
+
+//  buf е len ֽдļ offset  (ӦĿѷ)ĿϲΪһд룬дֽ
+int write_file(ext2_inode *node, int offset, const char *buf, int len)
+{
+    int done = 0, pos, off, run, start, n;
+    if (inline_valid(node))
+    {
+        inline_copy(node, offset, (char *)buf, len, 1);
+        return len;
+    }
+    while (done < len)
+    {
+        pos = offset + done;
+        off = pos % blocksiz;
+        start = bmap_run(node, pos / blocksiz, (off + len - done + blocksiz - 1) / blocksiz, &run);
+        n = run * blocksiz - off;
+        if (n > len - done)
+            n = len - done;
+        disk_write(block_pos(start) + off, buf + done, n);
+        done += n;
+    }
+    return done;
+}
+
+/*αֻ߼ [0, keep) Ĳ*/
+void extent_trim(ext2_inode *node, int keep)
+{
+    ext2_extent_header *eh = (ext2_extent_header *)node->i_pad;
+    int k;
+    if (eh->eh_magic != EXT2_PAD_EXTENT)
+        return;
+    for (k = 0; k < eh->eh_entries && k < EXT2_MAX_EXTENTS; k++)
+        if (eh->eh_ext[k].ee_block >= keep)
+            break;
+        else if (eh->eh_ext[k].ee_block + eh->eh_ext[k].ee_len > keep)
+            eh->eh_ext[k].ee_len = keep - eh->eh_ext[k].ee_block;
+    eh->eh_entries = k;
+}
+
+// ͷ ino ļ߼ keep ֮ȫݿ飬ԼҪһ (keep Ϊ 0 ʱͷȫ)ն
+void truncate_blocks(ext2_inode *node, int ino, int keep)
+{
+    int ptrs = blocksiz / sizeof(int); // ÿɴŵĿ
+    int n = node->i_blocks, l, k, a;
+    prealloc_discard(ino); // ͷŸļδԤ
+    if (keep >= n)
+        return;
+    for (l = keep; l < n; l++) // Ȱǰͷݿ
+        if ((a = bmap(node, l)) != 0)
+            DelBlock(a);
+    if (n > 6 && keep <= 6 && node->i_block[6] != 0) // һ
+    {
+        DelBlock(node->i_block[6]);
+        node->i_block[6] = 0;
+    }
+    if (n > 6 + ptrs && node->i_block[7] != 0) // ͷŲʹõĶ飬ȫʱͷŶ
+    {
+        k = keep > 6 + ptrs ? (keep - 6 - ptrs + ptrs - 1) / ptrs : 0;
+        for (; k < (n - 6 - ptrs + ptrs - 1) / ptrs; k++)
+        {
+            if ((a = map_get(node->i_block[7], k)) != 0)
+                DelBlock(a);
+        }
+        if (keep <= 6 + ptrs)
+        {
+            DelBlock(node->i_block[7]);
+            node->i_block[7] = 0;
+        }
+    }
+    for (l = keep; l < 6; l++)
+        node->i_block[l] = 0;
+    node->i_blocks = keep;
+    extent_trim(node, keep);
+}
+
+// ļ nblocks ݿʱܿ ()
+int blocks_with_index(int nblocks)
+{
+    int ptrs = blocksiz / sizeof(int);
+    int total = nblocks;
+    if (nblocks > 6)
+        total += 1; // һ
+    if (nblocks > 6 + ptrs)
+        total += 1 + (nblocks - 6 - ptrs + ptrs - 1) / ptrs; // 
+    return total;
+}
+
+/* ino ļĩβ׷ buf е len ֽڣ׷ӺĴСһηȫ¿ ()д롣
+  ߳иļдɹ 0ļ󳤶Ȼռ䲻㷵 1*/
+int append_file(ext2_inode *node, int ino, const char *buf, int len)
+{
+    int old_blocks = (node->i_size + blocksiz - 1) / blocksiz, new_blocks;
+    if ((long long)node->i_size + len > 0x7fffffff)
+        return 1;
+    new_blocks = (node->i_size + len + blocksiz - 1) / blocksiz;
+    if (new_blocks > 6 + blocksiz / 4 + (blocksiz / 4) * (blocksiz / 4) ||
+        blocks_with_index(new_blocks) - blocks_with_index(old_blocks) > free_blocks_avail(ino) ||
+        inline_prepare(node, ino, node->i_size + len) || alloc_file_blocks(node, ino, old_blocks, new_blocks))
+        return 1; // 䵽һʱѷĿļУɵдڵ
+    write_file(node, node->i_size, buf, len);
+    node->i_size += len;
+    return 0;
+}
+
+ext2_dir_entry *dir_entry_get(int pos, ext2_inode *node, ext2_dir_entry *buf);
+int dir_ino(ext2_inode *dir);
+
+/*Ŀ¼ϣĿ¼ﵽ DX_MIN_ENTRIES һΪѰַĹϣ
+  бĿ¼šĿ¼԰ 32 ֽƽ̴ţʶĳճ*/
+#define EXT2_PAD_DXDIR 0x02    // i_pad бĿ¼ϣ
+#define DX_MIN_ENTRIES 64      // Ŀ¼ﵽֵʱ
+#define DX_EMPTY (-1)          // ղ (ϣʼΪȫ 0xff)
+#define DX_DELETED (-2)        // ɾĲۣʱʱɸ
+
+typedef struct ext2_dx_root {
+    unsigned char dx_magic;  // EXT2_PAD_DXDIR
+    unsigned char dx_bits;   // ϣ 2^dx_bits 
+    unsigned short dx_pad;
+    int dx_block;            // ϣʼݿ
+    int dx_count;            // ǵĿ¼ i_size ˵ʧЧ
+    int dx_used;             // ǿղ (ɾĲ)
+    unsigned int dx_csum;    // Ŀ¼У ( dx_term)Ŀ¼˵ʧЧ
+} ext2_dx_root;
+
+// ÿĿ¼ڱιеУڵ±꣺0 δУ飬1 Ŀ¼һ£2 һ (ʱʱؽ)
+// УҪĿ¼ÿιֻһΣ֮Ŀ¼ͬһ޸ģٲһ
+#define DX_UNCHECKED 0
+#define DX_CHECKED 1
+#define DX_STALE 2
+unsigned char *dx_state = NULL;
+
+unsigned int dx_hash(const char *name) // FNV-1a
+{
+    unsigned int h = 2166136261u;
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+/*ʱոĿ¼У*/
+void dx_state_init()
+{
+    long n = (long)groups_count * blocksiz * 8;
+    dx_state = realloc(dx_state, n);
+    memset(dx_state, DX_UNCHECKED, n);
+}
+
+/*Ϊ iΪ name Ŀ¼УеһУǸ֮ͣĿ¼ƶı*/
+unsigned int dx_term(const char *name, int i)
+{
+    return dx_hash(name) * (2u * i + 1);
+}
+
+/*Ŀ¼ dir ǰ n Ŀ¼У*/
+unsigned int dx_sum(ext2_inode *dir, int n)
+{
+    ext2_dir_entry *ents = malloc(((long)n + 1) * sizeof(ext2_dir_entry));
+    unsigned int sum = 0;
+    int i;
+    read_file(dir, dir_ino(dir), 0, (char *)ents, n * dirsiz);
+    for (i = 0; i < n; i++)
+        sum += dx_term(ents[i].name, i);
+    free(ents);
+    return sum;
+}
+
+/*ǰ n Ŀ¼ʱУͺ˶һ (ÿιÿĿ¼ֻ˶һ) 1 ʾ*/
+int dx_verify(ext2_inode *dir, int n)
+{
+    ext2_dx_root *dx = (ext2_dx_root *)dir->i_pad;
+    int ino = dir_ino(dir);
+    if (dx_state[ino] == DX_UNCHECKED)
+        dx_state[ino] = dx_sum(dir, n) == dx->dx_csum ? DX_CHECKED : DX_STALE; // ˶ԵĽͬҪ
+    return dx_state[ino] == DX_CHECKED;
+}
+
+int dx_table_blocks(ext2_dx_root *dx)
+{
+    return (int)(((1L << dx->dx_bits) * sizeof(int) + blocksiz - 1) / blocksiz);
+}
+
+int dx_get(ext2_dx_root *dx, int slot)
+{
+    int v;
+    disk_read(block_pos(dx->dx_block) + (off_t)slot * sizeof(int), &v, sizeof(int));
+    return v;
+}
+
+void dx_set(ext2_dx_root *dx, int slot, int v)
+{
+    disk_write(block_pos(dx->dx_block) + (off_t)slot * sizeof(int), &v, sizeof(int));
+}
+
+/*Ŀ¼ dir Ƿ*/
+int dx_valid(ext2_inode *dir)
+{
+    ext2_dx_root *dx = (ext2_dx_root *)dir->i_pad;
+    return dir->i_mode == 2 && dx->dx_magic == EXT2_PAD_DXDIR && dx->dx_count == dir->i_size / dirsiz &&
+           dx_verify(dir, dx->dx_count);
+}
+
+/*ͷĿ¼ dir ĹϣռĿ*/
+void dx_release(ext2_inode *dir)
+{
+    ext2_dx_root *dx = (ext2_dx_root *)dir->i_pad;
+    int k;
+    if (dx->dx_magic != EXT2_PAD_DXDIR)
+        return;
+    for (k = 0; k < dx_table_blocks(dx); k++)
+        DelBlock(dx->dx_block + k);
+    memset(dx, 0, sizeof(ext2_dx_root));
+}
+
+/*ΪĿ¼ dir ½ϣȡСĿ¼ 4  2 ݣ 0 ʾɹ*/
+int dx_build(ext2_inode *dir)
+{
+    ext2_dx_root *dx = (ext2_dx_root *)dir->i_pad;
+    int n = dir->i_size / dirsiz;
+    int bits, nblocks, start, got, i, h, mask, *table;
+    unsigned int sum = 0;
+    ext2_dir_entry *ents;
+
+    dx_release(dir);
+    for (bits = 4; (1 << bits) < 4 * n; bits++)
+        ;
+    nblocks = (int)(((1L << bits) * sizeof(int) + blocksiz - 1) / blocksiz);
+    alloc_lock();
+    start = bitmap_alloc_run(&block_bitmap, last_allco_block, nblocks, &got);
+    if (start >= 0)
+        count_blocks(start, -got);
+    alloc_unlock();
+    if (start < 0)
+        return 1;
+    if (got < nblocks) // û㹻п飬
+    {
+        for (i = 0; i < got; i++)
+            DelBlock(start + i);
+        return 1;
+    }
+
+    table = malloc(nblocks * blocksiz);
+    ents = malloc(n * sizeof(ext2_dir_entry));
+    memset(table, 0xff, nblocks * blocksiz);
+    read_file(dir, dir_ino(dir), 0, (char *)ents, n * dirsiz);
+    mask = (1 << bits) - 1;
+    for (i = 0; i < n; i++) // ̽ÿĿ¼
+    {
+        for (h = dx_hash(ents[i].name) & mask; table[h] != DX_EMPTY; h = (h + 1) & mask)
+            ;
+        table[h] = i;
+        sum += dx_term(ents[i].name, i);
+    }
+    disk_write_cached(block_pos(start), table, nblocks * blocksiz); // ϣԪݣĿ¼ͬһд־
+    free(table);
+    free(ents);
+
+    dx->dx_magic = EXT2_PAD_DXDIR;
+    dx->dx_bits = bits;
+    dx->dx_pad = 0;
+    dx->dx_block = start;
+    dx->dx_count = n;
+    dx->dx_used = n;
+    dx->dx_csum = sum;
+    dx_state[dir_ino(dir)] = DX_CHECKED;
+    return 0;
+}
+
+/*ͨϣĿ¼ (ƺͶͬ)Ŀ¼ŲѲۺŴ *slotҲ -1*/
+int dx_find(ext2_inode *dir, char *name, int type, ext2_dir_entry *entry, int *slot)
+{
+    ext2_dx_root *dx = (ext2_dx_root *)dir->i_pad;
+    ext2_dir_entry *e;
+    int mask = (1 << dx->dx_bits) - 1;
+    int h, v, probes;
+    for (h = dx_hash(name) & mask, probes = 0; probes <= mask; h = (h + 1) & mask, probes++)
+    {
+        v = dx_get(dx, h);
+        if (v == DX_EMPTY)
+            break;
+        if (v == DX_DELETED)
+            continue;
+        e = dir_entry_get(v * dirsiz, dir, entry);
+        if (e->file_type == type && !strcmp(e->name, name))
+        {
+            if (e != entry)
+                *entry = *e;
+            if (slot)
+                *slot = h;
+            return v;
+        }
+    }
+    return -1;
+}
+
+/*Ŀ¼ ( nameΪһ) дʧЧĿ¼մﵽֵʱؽ*/
+void dx_insert(ext2_inode *dir, char *name)
+{
+    ext2_dx_root *dx = (ext2_dx_root *)dir->i_pad;
+    int n = dir->i_size / dirsiz;
+    int mask, h, v;
+    if (dx->dx_magic != EXT2_PAD_DXDIR || dx->dx_count != n - 1 || !dx_verify(dir, n - 1))
+    {
+        if (n >= DX_MIN_ENTRIES)
+            dx_build(dir);
+        return;
+    }
+    mask = (1 << dx->dx_bits) - 1;
+    for (h = dx_hash(name) & mask; (v = dx_get(dx, h)) >= 0; h = (h + 1) & mask)
+        ;
+    dx_set(dx, h, n - 1);
+    if (v == DX_EMPTY)
+        dx->dx_used++;
+    dx->dx_count = n;
+    dx->dx_csum += dx_term(name, n - 1);
+    if (dx->dx_used * 2 > mask + 1) // װʳһ (ɾ) ʱؽ
+        dx_build(dir);
+}
+
+/*ɾΪ j Ŀ¼ name (λڲ slot) ֮ԭһ moved ( last) ƶ j*/
+void dx_remove(ext2_inode *dir, int slot, int j, char *name, ext2_dir_entry *moved, int last)
+{
+    ext2_dx_root *dx = (ext2_dx_root *)dir->i_pad;
+    int mask = (1 << dx->dx_bits) - 1;
+    int h;
+    dx_set(dx, slot, DX_DELETED);
+    dx->dx_csum -= dx_term(name, j);
+    if (j != last)
+    {
+        for (h = dx_hash(moved->name) & mask; dx_get(dx, h) != last; h = (h + 1) & mask)
+            ;
+        dx_set(dx, h, j);
+        dx->dx_csum += dx_term(moved->name, j) - dx_term(moved->name, last);
+    }
+    dx->dx_count = dir->i_size / dirsiz;
+}
+
+// Ŀ¼ current вΪ nameΪ type Ŀ¼ҵʱ *entry ţ򷵻 -1
+// Ŀ¼пõĹϣʱңȽ
+int lookup(ext2_inode *current, char *name, int type, ext2_dir_entry *entry)
+{
+    ext2_dir_entry *e;
+    int i, ino;
+    if (dx_valid(current))
+        return dx_find(current, name, type, entry, NULL);
+    ino = dir_ino(current);
+    for (i = 0; i < current->i_size / dirsiz; i++)
+    {
+        if (i * dirsiz % blocksiz == 0) // µĿ¼
+            readahead(current, ino, i * dirsiz / blocksiz, 1);
+        e = dir_entry_get(i * dirsiz, current, entry);
+        if (e->file_type == type && !strcmp(e->name, name))
+        {
+            if (e != entry)
+                *entry = *e;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*Ŀ¼棺 (Ŀ¼ڵ, , ) ƽĽƲʱҲ (Ŀ¼)
+  ڵŽһϣĿ¼ (getstring)Create  Delete ʹӦĻʧЧ*/
+#define DCACHE_SIZE 256        // Ŀ¼
+#define DCACHE_HASH 128        // Ŀ¼ϣͰ
+
+typedef struct dentry {
+    int d_parent;                   // Ŀ¼ڵ (-1 ʾ)
+    int d_inode;                    // Ӧڵ (-1 ʾĿ¼)
+    int d_type;                     // ļ (1: ͨļ, 2: Ŀ¼)
+    char d_name[EXT2_NAME_LEN + 1]; // 
+    struct dentry *d_hnext;         // (d_parent, d_name) ϣ
+    struct dentry *d_inext;         // d_inode ϣ
+    struct dentry *d_prev;          // LRU ǰ
+    struct dentry *d_next;          // LRU 
+} dentry;
+
+dentry dcache[DCACHE_SIZE];
+dentry *dhash[DCACHE_HASH];
+dentry *dihash[DCACHE_HASH];
+dentry *dlru_head = NULL;
+dentry *dlru_tail = NULL;
+
+/*ʼĿ¼*/
+void dcache_init()
+{
+    int i;
+    for (i = 0; i < DCACHE_HASH; i++)
+    {
+        dhash[i] = NULL;
+        dihash[i] = NULL;
+    }
+    for (i = 0; i < DCACHE_SIZE; i++)
+    {
+        dcache[i].d_parent = -1;
+        dcache[i].d_hnext = NULL;
+        dcache[i].d_inext = NULL;
+        dcache[i].d_prev = i > 0 ? &dcache[i - 1] : NULL;
+        dcache[i].d_next = i < DCACHE_SIZE - 1 ? &dcache[i + 1] : NULL;
+    }
+    dlru_head = &dcache[0];
+    dlru_tail = &dcache[DCACHE_SIZE - 1];
+}
+
+unsigned int d_hashfn(int parent, const char *name)
+{
+    return (dx_hash(name) ^ (unsigned int)parent * 2654435761u) % DCACHE_HASH;
+}
+
+/*Ŀ¼ƶ LRU ͷ*/
+void d_touch(dentry *d)
+{
+    if (d == dlru_head)
+        return;
+    d->d_prev->d_next = d->d_next;
+    if (d->d_next)
+        d->d_next->d_prev = d->d_prev;
+    else
+        dlru_tail = d->d_prev;
+    d->d_prev = NULL;
+    d->d_next = dlru_head;
+    dlru_head->d_prev = d;
+    dlru_head = d;
+}
+
+/*Ŀ¼ϣժƵ LRU β´ȸ*/
+void d_drop(dentry *d)
+{
+    dentry **p;
+    if (d->d_parent == -1)
+        return;
+    for (p = &dhash[d_hashfn(d->d_parent, d->d_name)]; *p != d; p = &(*p)->d_hnext)
+        ;
+    *p = d->d_hnext;
+    if (d->d_inode >= 0)
+    {
+        for (p = &dihash[d->d_inode % DCACHE_HASH]; *p != d; p = &(*p)->d_inext)
+            ;
+        *p = d->d_inext;
+    }
+    d->d_parent = -1;
+    if (d == dlru_tail)
+        return;
+    if (d->d_prev)
+        d->d_prev->d_next = d->d_next;
+    else
+        dlru_head = d->d_next;
+    d->d_next->d_prev = d->d_prev;
+    d->d_prev = dlru_tail;
+    d->d_next = NULL;
+    dlru_tail->d_next = d;
+    dlru_tail = d;
+}
+
+/* parent Ŀ¼Ϊ nameΪ type Ļδʱ NULL (߳л)*/
+dentry *d_lookup(int parent, const char *name, int type)
+{
+    dentry *d;
+    for (d = dhash[d_hashfn(parent, name)]; d != NULL; d = d->d_hnext)
+        if (d->d_parent == parent && d->d_type == type && !strcmp(d->d_name, name))
+        {
+            d_touch(d);
+            return d;
+        }
+    return NULL;
+}
+
+/*һƽĽino Ϊ -1 ʱΪĿ¼*/
+void d_add(int parent, const char *name, int type, int ino)
+{
+    dentry *d;
+    unsigned int h;
+    cache_lock();
+    d = d_lookup(parent, name, type);
+    if (d != NULL)
+        d_drop(d);
+    d = dlru_tail; // ̭δʹõĻ
+    d_drop(d);
+    d->d_parent = parent;
+    d->d_inode = ino;
+    d->d_type = type;
+    strncpy(d->d_name, name, EXT2_NAME_LEN);
+    d->d_name[EXT2_NAME_LEN] = 0;
+    h = d_hashfn(parent, d->d_name);
+    d->d_hnext = dhash[h];
+    dhash[h] = d;
+    if (ino >= 0)
+    {
+        d->d_inext = dihash[ino % DCACHE_HASH];
+        dihash[ino % DCACHE_HASH] = d;
+    }
+    d_touch(d);
+    cache_unlock();
+}
+
+/*ڵŷڸĿ¼е (Ŀ¼Ϊ "."Ŀ¼ "."  "..")δʱ NULL (߳л)*/
+dentry *d_reverse(int ino)
+{
+    dentry *d;
+    for (d = dihash[ino % DCACHE_HASH]; d != NULL; d = d->d_inext)
+        if (d->d_inode == ino && d->d_type == 2 &&
+            (ino == 0 ? !strcmp(d->d_name, ".") : strcmp(d->d_name, ".") && strcmp(d->d_name, "..")))
+        {
+            d_touch(d);
+            return d;
+        }
+    return NULL;
+}
+
+/* name  parent Ŀ¼½ɾʹӦĻʧЧ*/
+void d_invalidate(int parent, const char *name, int type)
+{
+    dentry *d;
+    cache_lock();
+    d = d_lookup(parent, name, type);
+    if (d != NULL)
+        d_drop(d);
+    cache_unlock();
+}
+
+/*ino ɾ󣬶ָԼλ֮µл*/
+void d_invalidate_inode(int ino)
+{
+    int i;
+    cache_lock();
+    for (i = 0; i < DCACHE_SIZE; i++)
+        if (dcache[i].d_parent != -1 && (dcache[i].d_inode == ino || dcache[i].d_parent == ino))
+            d_drop(&dcache[i]);
+    cache_unlock();
+}
+
+/*Ŀ¼ dir ڵ (һĿ¼ "." м¼)*/
+int dir_ino(ext2_inode *dir)
+{
+    ext2_dir_entry buf;
+    return dir_entry_get(0, dir, &buf)->inode;
+}
+
+// ɵֽڶȡʽÿֽڶ¶λһΣ readperf Ա
+int read_file_bytewise(ext2_inode *node, int ino, char *buf)
+{
+    int i;
+    if (inline_valid(node))
+        return read_file(node, ino, 0, buf, node->i_size);
+    for (i = 0; i < node->i_size; i++)
+        if (is_hole(node, bmap(node, i / blocksiz)))
+            buf[i] = 0;
+        else
+            disk_read(dir_entry_position(i, node), &buf[i], sizeof(char));
+    return node->i_size;
+}
+
+// ȡĿ¼ֽλ pos Ŀ¼ڴӳģʽֱӷӳָ룬 buf  buf
+ext2_dir_entry *dir_entry_get(int pos, ext2_inode *node, ext2_dir_entry *buf)
+{
+    off_t location = dir_entry_position(pos, node);
+    ext2_dir_entry *p = (ext2_dir_entry *)disk_ptr(location);
+    if (p != NULL)
+        return p;
+    disk_read(location, buf, sizeof(ext2_dir_entry));
+    return buf;
+}
+
+// ȡ n ڵ㣺ڵ㻺 buf  buf (пδдص޸ģֱӶӳ)
+ext2_inode *inode_get(int n, ext2_inode *buf)
+{
+    inode_read(n, buf);
+    return buf;
+}
+
+// ΪǰĿ¼ѰһĿ¼ĿλòؾԵַҪ¿ռ䲻ʱ -1
+off_t FindEntry(ext2_inode *current)
+{
+    off_t location; // Ŀľλ
+    int b;
+    if (current->i_size % blocksiz == 0) // ǰĿ¼ĴСǿ˵ǰҪһ¿
+    {
+        if ((b = FindBlock()) < 0)
+            return -1;
+        if (add_block(current, current->i_blocks, b)) // һµݿ飬ͬʱ¿
+        {
+            DelBlock(b);
+            return -1;
+        }
+    }
+    location = dir_entry_position(current->i_size, current); // ĿһĿ¼֮
+    current->i_size += dirsiz; // µǰĿ¼ĴС
+    return location; // ҵĿĿ¼Ŀλ
+}
+
+/*¼֤洢Ƿƥ䣬ƥ䣬򷵻 0벻ƥ䣬򷵻طֵ*/
+int login()
+{
+    char psw[16]; // ڴ洢
+    if (!batch_mode)
+        printf("루ԭʼΪ9331");
+    if (scanf("%15s", psw) != 1) // 룬ʱΪ¼ʧ
+        return 1;
+    return strcmp(gdt[0].password, psw); // Ƚ洢
+}
+
+int Open(ext2_inode *current, char *name);//Open
+
+/*ȡǰĿ¼Ŀ¼ cs_name_nameڴ洢ȡĿ¼ nodeǰĿ¼ڵ*/
+void getstring(char *cs_name, ext2_inode node)
+{
+    ext2_inode current = node; // ǰĿ¼ڵ
+    int i, j = 0, self = dir_ino(&node), up;
+    ext2_dir_entry buf, *dir; // Ŀ¼
+    dentry *d;
+
+    cache_lock();
+    if ((d = d_reverse(self)) != NULL) // Ŀ¼Уɨ踸Ŀ¼
+    {
+        strcpy(cs_name, d->d_name);
+        cache_unlock();
+        return;
+    }
+    cache_unlock();
+
+    // 򿪸Ŀ¼
+    Open(&current, ".."); // currentָĿ¼ϼĿ¼
+    up = dir_ino(&current);
+
+    // ҵǰĿ¼е"."ʾǰĿ¼ȡӦڵ
+    for (i = 0; i < node.i_size / 32; i++)
+    {
+        if (i * 32 % blocksiz == 0) // µĿ¼
+            readahead(&node, self, i * 32 / blocksiz, 1);
+        dir = dir_entry_get(i * 32, &node, &buf); // ȡĿ¼
+        if (!strcmp(dir->name, ".")) // Ŀ¼Ϊ"."ǰĿ¼
+        {
+            j = dir->inode; // Ŀ¼Ӧڵ
+            break;
+        }
+    }
+
+    // ҸĿ¼뵱ǰĿ¼ӦĿ¼ȡ
+    for (i = 0; i < current.i_size / 32; i++)
+    {
+        if (i * 32 % blocksiz == 0)
+            readahead(&current, up, i * 32 / blocksiz, 1);
+        dir = dir_entry_get(i * 32, &current, &buf); // ȡĿ¼
+        if (dir->inode == j) // Ŀ¼ڵ뵱ǰĿ¼ͬ
+        {
+            strcpy(cs_name, dir->name); // Ŀ¼Ƶַ cs_name 
+            d_add(dir_ino(&current), dir->name, 2, j); // Ŀ¼
+            return; // 
+        }
+    }
+}
+
+/********************/
+/**********㺯**********/
+
+/*ָĿ¼ΪǰĿ¼,current ָ´򿪵ĵǰĿ¼ext2_inode*/
+int Open(ext2_inode *current, char *name)
+{
+    stat_ctx sc = stat_enter(STAT_OPEN);
+    ext2_dir_entry entry;
+    int parent = dir_ino(current), ino;
+    dentry *d;
+
+    cache_lock();
+    d = d_lookup(parent, name, 2);
+    ino = d != NULL ? d->d_inode : -2; // ֻܱ̭߳ȡڵ
+    cache_unlock();
+    if (ino == -2) // Ŀ¼δʱĿ¼ѽ () 뻺
     {
-        // λǰĿ¼Ĵ洢λ
-        fseek(fp, dir_entry_position(i * 32, current->i_block), SEEK_SET);
-        fread(&dir, sizeof(ext2_dir_entry), 1, fp);
-
-        if (!strcmp(dir.name, name)) // ƥĿĿ¼
-        {
-            if (dir.file_type == 2) // Ŀ¼
-            {
-                // ȡĿĿ¼ڵϢ
-                fseek(fp, 3 * blocksiz + dir.inode * sizeof(ext2_inode), SEEK_SET);
-                fread(current, sizeof(ext2_inode), 1, fp);
-                fclose(fp); // رļ
-                return 0;   // 򿪳ɹ
-            }
-        }
+        inode_lock(parent, 0);
+        ino = lookup(current, name, 2, &entry) >= 0 ? entry.inode : -1;
+        d_add(parent, name, 2, ino);
+        inode_unlock(parent);
+    }
+    if (ino >= 0)
+    {
+        // ȡĿĿ¼ڵϢ
+        inode_lock(ino, 0);
+        inode_read(ino, current);
+        inode_unlock(ino);
+        return stat_leave(&sc, 0);   // 򿪳ɹ
     }
 
-    fclose(fp); // رļ
-    return 1;   // ʧ
+    return stat_leave(&sc, 1);   // ʧ
 }
 
 /*رյǰĿ¼,ʱ䣬һĿ¼ΪµĵǰĿ¼*/
@@ -501,22 +3159,16 @@ int Close(ext2_inode *current)
 {
     time_t now;
     ext2_dir_entry parent_entry; // Ŀ¼Ϣ
-    FILE *fout;
 
-    fout = fopen(PATH, "r+"); // ļжд
     time(&now); // ȡǰʱ
 
     current->i_atime = now; // ʱ
 
     // λȡǰĿ¼ӦĿ¼
-    fseek(fout, (data_begin_block + current->i_block[0]) * blocksiz, SEEK_SET);
-    fread(&parent_entry, sizeof(ext2_dir_entry), 1, fout);
+    disk_read(block_pos(current->i_block[0]), &parent_entry, sizeof(ext2_dir_entry));
 
     // ڵϢļϵͳ
-    fseek(fout, 3 * blocksiz + (parent_entry.inode) * sizeof(ext2_inode), SEEK_SET);
-    fwrite(current, sizeof(ext2_inode), 1, fout);
-
-    fclose(fout); // رļ
+    inode_write(parent_entry.inode, current);
 
     // 򿪸Ŀ¼ΪǰĿ¼
     return Open(current, "..");
@@ -524,159 +3176,312 @@ int Close(ext2_inode *current)
 
 /*ӵǰĿ¼жȡļݣnameΪļ*/
 int Read(ext2_inode *current, char *name) {
-    FILE *fp = NULL;
+    stat_ctx sc = stat_enter(STAT_READ);
     int i;
-    while (fp == NULL)
-        fp = fopen(PATH, "r+"); // ļϵͳ
-
-    int fd = fileno(fp);
-    if (flock(fd, LOCK_SH) == -1) { // ӹ
-        perror("޷Ӷ");
-        fclose(fp);
-        return -1;
-    }
-
-    for (i = 0; i < (current->i_size / 32); i++) {
-        fseek(fp, dir_entry_position(i * 32, current->i_block), SEEK_SET);
-        fread(&dir, sizeof(ext2_dir_entry), 1, fp);
-        if (!strcmp(dir.name, name)) {
-            if (dir.file_type == 1) {
-                time_t now;
-                ext2_inode node;
-                char content_char;
-                fseek(fp, 3 * blocksiz + dir.inode * sizeof(ext2_inode), SEEK_SET);
-                fread(&node, sizeof(ext2_inode), 1, fp);
-
-                for (i = 0; i < node.i_size; i++) {
-                    fseek(fp, dir_entry_position(i, node.i_block), SEEK_SET);
-                    fread(&content_char, sizeof(char), 1, fp);
-                    if (content_char == 0xD)
-                        printf("\n");
-                    else
-                        printf("%c", content_char);
-                }
-                printf("\n");
+    int parent = dir_ino(current);
+    inode_lock(parent, 0); // ȡڼĿ¼ᱻɾ
+
+    if (lookup(current, name, 1, &dir) >= 0) {
+        time_t now;
+        ext2_inode node;
+        char *buf = malloc(READ_CHUNK); // ʱջ
+        int n, k;
+        inode_lock(dir.inode, 0); // ߲
+        inode_read(dir.inode, &node);
+
+        for (i = 0; i < node.i_size; i += n) { // ÿζȡ
+            n = read_file(&node, dir.inode, i, buf, READ_CHUNK);
+            for (k = 0; k < n; k++)
+                if (buf[k] == 0xD)
+                    buf[k] = '\n';
+            fwrite(buf, 1, n, stdout);
+        }
+        free(buf);
+        printf("\n");
 
-                time(&now);
-                node.i_atime = now;
-                fseek(fp, 3 * blocksiz + dir.inode * sizeof(ext2_inode), SEEK_SET);
-                fwrite(&node, sizeof(ext2_inode), 1, fp);
+        time(&now);
+        node.i_atime = now;
+        inode_write(dir.inode, &node);
 
-                flock(fd, LOCK_UN); // ͷ
-                fclose(fp);
-                return 0;
-            }
-        }
+        inode_unlock(dir.inode);
+        inode_unlock(parent);
+        return stat_leave(&sc, 0);
     }
 
-    flock(fd, LOCK_UN); // ͷ
-    fclose(fp);
-    return 1; // ļδҵ
+    inode_unlock(parent);
+    return stat_leave(&sc, 1); // ļδҵ
 }
 
 
-/*Ŀ¼ 'current' еļ 'name' дݡļĿ¼вڣʾûȴļ*/
+/*Ƚֽڶȡ밴ȡļ 'name' ٶȣַʽֽ/*/
+int ReadPerf(ext2_inode *current, char *name)
+{
+    ext2_dir_entry entry;
+    ext2_inode node;
+    char *buf;
+    int i, n;
+    double t0, t1, t2;
+
+    if (lookup(current, name, 1, &entry) < 0)
+        return 1; // ļδҵ
+    inode_read(entry.inode, &node);
+    buf = malloc(node.i_size + 1);
+
+    t0 = now_sec();
+    read_file_bytewise(&node, entry.inode, buf);
+    t1 = now_sec();
+    for (i = 0; i < node.i_size; i += n) // ȡÿһ READ_CHUNK
+        n = read_file(&node, entry.inode, i, buf + i, READ_CHUNK);
+    t2 = now_sec();
+
+    printf("%d ֽ\n", node.i_size);
+    printf("ֽڶȡ: %.6f , %.0f ֽ/\n", t1 - t0, node.i_size / (t1 - t0 > 0 ? t1 - t0 : 1e-9));
+    printf("ȡ  : %.6f , %.0f ֽ/\n", t2 - t1, node.i_size / (t2 - t1 > 0 ? t2 - t1 : 1e-9));
+    free(buf);
+    return 0;
+}
+
+/*Ŀ¼ 'current' еļ 'name' дݡļĿ¼вڣʾûȴļ
+  ȻڴУ (򻺳) ʱŰܳһηݿ鲢д*/
 int Write(ext2_inode *current, char *name) {
-    FILE *fp = NULL;
+    stat_ctx sc = stat_enter(STAT_WRITE);
     ext2_dir_entry dir;
     ext2_inode node;
     time_t now;
-    char str;
-    int i;
-
-    while (fp == NULL)
-        fp = fopen(PATH, "r+");
-
-    int fd = fileno(fp);
-    if (flock(fd, LOCK_EX) == -1) { // Ӷռ
-        perror("޷д");
-        fclose(fp);
-        return -1;
-    }
-
-    while (1) {
-        for (i = 0; i < (current->i_size / 32); i++) {
-            fseek(fp, dir_entry_position(i * 32, current->i_block), SEEK_SET);
-            fread(&dir, sizeof(ext2_dir_entry), 1, fp);
-            if (!strcmp(dir.name, name)) {
-                if (dir.file_type == 1) {
-                    fseek(fp, 3 * blocksiz + dir.inode * sizeof(ext2_inode), SEEK_SET);
-                    fread(&node, sizeof(ext2_inode), 1, fp);
-                    break;
-                }
-            }
-        }
-        if (i < current->i_size / 32)
-            break;
+    char str, *buf;
+    int n = 0, full = 0;
+    int parent = dir_ino(current);
 
+    inode_lock(parent, 0); // дڼĿ¼ᱻɾ
+    if (lookup(current, name, 1, &dir) < 0) {
         printf("ļڣȴļ\n");
-        flock(fd, LOCK_UN); // ͷ
-        fclose(fp);
-        return 0;
+        inode_unlock(parent);
+        return stat_leave(&sc, 0);
     }
+    inode_lock(dir.inode, 1); // ռֻͬһļĶд
+    inode_read(dir.inode, &node);
+    buf = malloc(WRITE_BUFFER);
 
-    str = getch();
+    if (batch_mode)
+        batch_skip_line(); // ݴһпʼ
+    str = batch_mode ? batch_getc() : getch();
     while (str != 27) {
-        printf("%c", str);
-
-        if (!(node.i_size % 512)) {
-            add_block(&node, node.i_size / 512, FindBlock());
-            node.i_blocks += 1;
+        if (!batch_mode) // ģʽ
+            printf("%c", str);
+
+        buf[n++] = str;
+        if (n == WRITE_BUFFER) { // Ȱⲿдļ
+            if (!full && append_file(&node, dir.inode, buf, n))
+                full = 1; // ռ䲻㣬ֻ֮ȡд
+            n = 0;
         }
 
-        fseek(fp, dir_entry_position(node.i_size, node.i_block), SEEK_SET);
-        fwrite(&str, sizeof(char), 1, fp);
-
-        node.i_size += sizeof(char);
-
-        if (str == 0x0d)
+        if (str == 0x0d && !batch_mode)
             printf("%c", 0x0a);
 
-        str = getch();
+        str = batch_mode ? batch_getc() : getch();
         if (str == 27)
             break;
     }
+    if (n > 0 && !full && append_file(&node, dir.inode, buf, n)) // ʱһη䲢д뻺
+        full = 1;
+    free(buf);
+    if (full)
+        printf("\nռ䲻㣬ûд");
 
     time(&now);
     node.i_mtime = now;
     node.i_atime = now;
 
-    fseek(fp, 3 * blocksiz + dir.inode * sizeof(ext2_inode), SEEK_SET);
-    fwrite(&node, sizeof(ext2_inode), 1, fp);
+    inode_write(dir.inode, &node);
 
-    flock(fd, LOCK_UN); // ͷ
-    fclose(fp);
+    inode_unlock(dir.inode);
+    inode_unlock(parent);
     printf("\n");
+    return stat_leave(&sc, 0);
+}
+
+int Create(int type, ext2_inode *current, char *name);
+int Delete(int type, ext2_inode *current, char *name);
+
+/*ļ hostfile ݵ뵽ǰĿ¼ļ 'name' Уļʱȴʱ׷ӵĩβ
+  һԷȫݿ飬ٰ COPY_CHUNK ˣ 0 ʾɹʽ Write ͬ*/
+int Import(ext2_inode *current, char *hostfile, char *name)
+{
+    ext2_dir_entry entry;
+    ext2_inode node;
+    FILE *hf;
+    struct stat st;
+    char *buf;
+    long size, done;
+    int n, old_blocks, new_blocks, created = 0, fail = 1;
+    int parent = dir_ino(current);
+    double t0, t1;
+    time_t now;
+
+    if ((hf = fopen(hostfile, "rb")) == NULL)
+    {
+        printf("޷ļ %s\n", hostfile);
+        return 1;
+    }
+    fstat(fileno(hf), &st);
+    size = st.st_size;
+    if (size > 0x7fffffff) // i_size  int
+    {
+        printf("ļ: 󳬹 2GB\n");
+        fclose(hf);
+        return 1;
+    }
+    if (lookup(current, name, 1, &entry) < 0) // ʱȴ (Create ԼĿ¼д)
+    {
+        new_blocks = (size + blocksiz - 1) / blocksiz;
+        if (blocks_with_index(new_blocks) > free_blocks_avail(-1)) // ռ㹻ʱŴļ
+        {
+            printf("ռ䲻: Ҫ %d \n", blocks_with_index(new_blocks));
+            fclose(hf);
+            return 1;
+        }
+        if (Create(1, current, name) == 1)
+        {
+            fclose(hf);
+            return 1;
+        }
+        created = 1;
+    }
+    inode_lock(parent, 0); // ڼĿ¼ᱻɾ
+    if (lookup(current, name, 1, &entry) < 0) // ɾ
+    {
+        inode_unlock(parent);
+        fclose(hf);
+        return 1;
+    }
+    inode_lock(entry.inode, 1); // ռͬһļĶд
+    inode_read(entry.inode, &node);
+
+    old_blocks = (node.i_size + blocksiz - 1) / blocksiz;
+    new_blocks = (node.i_size + size + blocksiz - 1) / blocksiz;
+    if ((long long)node.i_size + size > 0x7fffffff)
+        printf("ļ: 󳬹 2GB\n");
+    else if (new_blocks > 6 + blocksiz / 4 + (blocksiz / 4) * (blocksiz / 4) ||
+             blocks_with_index(new_blocks) - blocks_with_index(old_blocks) > free_blocks_avail(entry.inode))
+        printf("ռ䲻: Ҫ %d \n", blocks_with_index(new_blocks) - blocks_with_index(old_blocks));
+    else if (inline_prepare(&node, entry.inode, node.i_size + size) ||
+             alloc_file_blocks(&node, entry.inode, old_blocks, new_blocks)) // Ԥȷ䣬ݿ龡
+    {
+        printf("ռ䲻: ûдκ\n");
+        truncate_blocks(&node, entry.inode, old_blocks); // ͷŷ䵽һĿ飬ļָԭ
+        inode_write(entry.inode, &node);
+    }
+    else
+        fail = 0;
+    if (fail)
+    {
+        inode_unlock(entry.inode);
+        inode_unlock(parent);
+        if (created) // Delete Լͷ
+            Delete(1, current, name);
+        fclose(hf);
+        return 1;
+    }
+
+    t0 = now_sec();
+    buf = malloc(COPY_CHUNK);
+    for (done = 0; done < size; done += n)
+    {
+        n = fread(buf, 1, COPY_CHUNK, hf);
+        if (n <= 0)
+            break;
+        write_file(&node, node.i_size, buf, n);
+        node.i_size += n;
+    }
+    free(buf);
+    fclose(hf);
+    if (done < size) // ļȡ̣ͷŶĿ
+        truncate_blocks(&node, entry.inode, (node.i_size + blocksiz - 1) / blocksiz);
+
+    time(&now);
+    node.i_mtime = now;
+    node.i_atime = now;
+    inode_write(entry.inode, &node);
+    t1 = now_sec();
+    inode_unlock(entry.inode);
+    inode_unlock(parent);
+    printf(" %ld ֽ, %.6f , %.2f MB/\n", done, t1 - t0, done / 1048576.0 / (t1 - t0 > 0 ? t1 - t0 : 1e-9));
     return 0;
 }
 
+/*ѵǰĿ¼еļ 'name'  COPY_CHUNK 鵼ļ hostfile 0 ʾɹʽ Read ͬ*/
+int Export(ext2_inode *current, char *name, char *hostfile)
+{
+    ext2_dir_entry entry;
+    ext2_inode node;
+    FILE *hf;
+    char *buf;
+    int done, n;
+    int parent = dir_ino(current);
+    double t0, t1;
+
+    inode_lock(parent, 0); // ڼĿ¼ᱻɾ
+    if (lookup(current, name, 1, &entry) < 0)
+    {
+        inode_unlock(parent);
+        return 1; // ļδҵ
+    }
+    if ((hf = fopen(hostfile, "wb")) == NULL)
+    {
+        printf("޷ļ %s\n", hostfile);
+        inode_unlock(parent);
+        return 1;
+    }
+    inode_lock(entry.inode, 0); // ߲
+    inode_read(entry.inode, &node);
+
+    t0 = now_sec();
+    buf = malloc(COPY_CHUNK);
+    for (done = 0; done < node.i_size; done += n)
+    {
+        n = read_file(&node, entry.inode, done, buf, COPY_CHUNK);
+        fwrite(buf, 1, n, hf);
+    }
+    free(buf);
+    fclose(hf);
+    t1 = now_sec();
+    inode_unlock(entry.inode);
+    inode_unlock(parent);
+    printf(" %d ֽ, %.6f , %.2f MB/\n", done, t1 - t0, done / 1048576.0 / (t1 - t0 > 0 ? t1 - t0 : 1e-9));
+    return 0;
+}
 
 /*Ŀ¼type=1 ļtype=2 Ŀ¼current ǰĿ¼ڵ㡢name ļĿ¼*/
 int Create(int type, ext2_inode *current, char *name)
 {
-    FILE *fout = NULL;
+    stat_ctx sc = stat_enter(STAT_CREATE);
     int i;
     int block_location;     // block location
     int node_location;      // node location
-    int dir_entry_location; // dir entry location
+    off_t dir_entry_location; // dir entry location
     time_t now;
     ext2_inode ainode;
     ext2_dir_entry aentry, bentry; // bentry浱ǰϵͳĿ¼Ϣ
+    int parent = dir_ino(current);
     time(&now);
-    fout = fopen(PATH, "r+");
-    node_location = FindInode(); // Ѱҿ
+    inode_lock(parent, 1); // غͲĿ¼֮Ŀ¼ܱ޸
 
     // ǷظļĿ¼
-    for (i = 0; i < current->i_size / dirsiz; i++)
+    if (lookup(current, name, type, &aentry) >= 0)
     {
-        fseek(fout, dir_entry_position(i * sizeof(ext2_dir_entry), current->i_block), SEEK_SET);
-        fread(&aentry, sizeof(ext2_dir_entry), 1, fout);
-        if (aentry.file_type == type && !strcmp(aentry.name, name))
-            return 1;
+        inode_unlock(parent);
+        return stat_leave(&sc, 1);
+    }
+    disk_read(block_pos(current->i_block[0]), &bentry, sizeof(ext2_dir_entry)); // current's dir_entry
+    // Ѱҿ (ȷϲٷ䣬й© inode)Ŀ¼ŵϿе飬ļ븸Ŀ¼ͬһ
+    node_location = FindInode(type == 2 ? find_group_dir() : (int)bentry.inode);
+    if (node_location < 0)
+    {
+        printf("ռ䲻: ûпеڵ\n");
+        inode_unlock(parent);
+        return stat_leave(&sc, 1);
     }
-
-    fseek(fout, (data_begin_block + current->i_block[0]) * blocksiz, SEEK_SET);
-    fread(&bentry, sizeof(ext2_dir_entry), 1, fout); // current's dir_entry
     if (type == 1)  //ļ
     {
         ainode.i_mode = 1;
@@ -704,8 +3509,19 @@ int Create(int type, ext2_inode *current, char *name)
         ainode.i_ctime = now;
         ainode.i_mtime = now;
         ainode.i_dtime = 0;
+        last_allco_block = inode_group(node_location) * blocks_per_group; // Ŀ¼Ŀ¼ڵͬһ
         block_location = FindBlock();
+        if (block_location < 0)
+        {
+            printf("ռ䲻: ûпеݿ\n");
+            DelInode(node_location);
+            inode_unlock(parent);
+            return stat_leave(&sc, 1);
+        }
         ainode.i_block[0] = block_location;
+        alloc_lock();
+        gdt[inode_group(node_location)].bg_used_dirs_count++;
+        alloc_unlock();
         for (i = 1; i < 8; i++)
         {
             ainode.i_block[i] = 0;
@@ -722,8 +3538,7 @@ int Create(int type, ext2_inode *current, char *name)
         strcpy(aentry.name, ".");
         printf(".dir\n");
         aentry.dir_pad = 0;
-        fseek(fout, (data_begin_block + block_location) * blocksiz, SEEK_SET);
-        fwrite(&aentry, sizeof(ext2_dir_entry), 1, fout);
+        disk_write(block_pos(block_location), &aentry, sizeof(ext2_dir_entry));
         //һĿ¼
         aentry.inode = bentry.inode;
         aentry.rec_len = sizeof(ext2_dir_entry);
@@ -731,20 +3546,35 @@ int Create(int type, ext2_inode *current, char *name)
         aentry.file_type = 2;
         strcpy(aentry.name, "..");
         aentry.dir_pad = 0;
-        fwrite(&aentry, sizeof(ext2_dir_entry), 1, fout);
+        disk_write(block_pos(block_location) + dirsiz, &aentry, sizeof(ext2_dir_entry));
         printf("..dir\n");
         //һĿ
         aentry.inode = 0;
         aentry.rec_len = sizeof(ext2_dir_entry);
         aentry.name_len = 0;
         aentry.file_type = 0;
-        aentry.name[EXT2_NAME_LEN] = 0;
+        aentry.name[0] = 0;
         aentry.dir_pad = 0;
-        fwrite(&aentry, sizeof(ext2_dir_entry), 14, fout); //ݿ
+        for (i = 2; i < blocksiz / dirsiz; i++) //ݿ
+            disk_write(block_pos(block_location) + i * dirsiz, &aentry, sizeof(ext2_dir_entry));
     }                                                      // end else
+    dir_entry_location = FindEntry(current); // ڸĿ¼ռλãʧʱǰķ
+    if (dir_entry_location < 0)
+    {
+        printf("ռ䲻: ûпеݿ\n");
+        if (type == 2)
+        {
+            DelBlock(block_location);
+            alloc_lock();
+            gdt[inode_group(node_location)].bg_used_dirs_count--;
+            alloc_unlock();
+        }
+        DelInode(node_location);
+        inode_unlock(parent);
+        return stat_leave(&sc, 1);
+    }
     //½inode
-    fseek(fout, 3 * blocksiz + (node_location) * sizeof(ext2_inode), SEEK_SET);
-    fwrite(&ainode, sizeof(ext2_inode), 1, fout);
+    inode_write(node_location, &ainode);
     // ½inode Ϣдcurrent ָݿ
     aentry.inode = node_location;
     aentry.rec_len = dirsiz;
@@ -759,29 +3589,23 @@ int Create(int type, ext2_inode *current, char *name)
     } //Ŀ¼
     strcpy(aentry.name, name);
     aentry.dir_pad = 0;
-    dir_entry_location = FindEntry(current);
-    fseek(fout, dir_entry_location, SEEK_SET); //λĿλ
-    fwrite(&aentry, sizeof(ext2_dir_entry), 1, fout);
+    disk_write(dir_entry_location, &aentry, sizeof(ext2_dir_entry));
+    dx_insert(current, name); // Ŀ¼ϣ
+    d_invalidate(bentry.inode, name, type); // ܴڵĸĿ¼
 
     //current Ϣ,bentry current ָblock еĵһ
-    //ext2_inode cinode;
-    fseek(fout, 3 * blocksiz + (bentry.inode) * sizeof(ext2_inode), SEEK_SET);
-
-    // fread(&cinode, sizeof(ext2_inode), 1, fout);
-    // printf("after_cinode.i_size: %d\n", cinode.i_size);
-
-    fwrite(current, sizeof(ext2_inode), 1, fout);
-    fclose(fout);
-    return 0;
+    inode_write(bentry.inode, current);
+    inode_unlock(parent);
+    return stat_leave(&sc, 0);
 }
 
 /*ڵǰĿ¼ɾĿ¼ļ*/
 int Delete(int type, ext2_inode *current, char *name)
 {
-    FILE *fout = NULL;
-    int i, j, t, k, flag;
-    int node_location, dir_entry_location, block_location, e_location;
-    int block_location2, block_location3;
+    stat_ctx sc = stat_enter(STAT_DELETE);
+    int j, slot;
+    int node_location, parent;
+    off_t dir_entry_location;
     ext2_inode cinode;
     ext2_dir_entry centry, dentry, eentry;
     // ʼɾĿĿսṹ
@@ -792,218 +3616,325 @@ int Delete(int type, ext2_inode *current, char *name)
     strcpy(dentry.name, "");
     dentry.dir_pad = 0;
 
-    fout = fopen(PATH, "r+");
-    t = (int)(current->i_size / dirsiz); // 㵱ǰĿ¼Ŀ
-    flag = 0; // ڱǷҵĿļĿ¼
-
-    // Ŀ¼λĿļĿ¼
-    for (i = 0; i < t; i++)
-    {
-        dir_entry_location = dir_entry_position(i * dirsiz, current->i_block);
-        fseek(fout, dir_entry_location, SEEK_SET);
-        fread(&centry, sizeof(ext2_dir_entry), 1, fout);
-        if ((strcmp(centry.name, name) == 0) && (centry.file_type == type))
-        {
-            flag = 1;
-            j = i;
-            break;
-        }
-    }
+    // Ŀ¼λĿļĿ¼ (йϣʱͬʱڵĲ)
+    parent = dir_ino(current);
+    inode_lock(parent, 1); //  ( ext2_server) ѳиʱֻ
+    slot = -1;
+    if (dx_valid(current))
+        j = dx_find(current, name, type, &centry, &slot);
+    else
+        j = lookup(current, name, type, &centry);
     // ҵĿļĿ¼
-    if (flag)
+    if (j >= 0)
     {
         node_location = centry.inode;  // ȡinode
-        fseek(fout, 3 * blocksiz + node_location * sizeof(ext2_inode), SEEK_SET); // λinodeλ
-        fread(&cinode, sizeof(ext2_inode), 1, fout); // ȡinodeϢ
+        inode_lock(node_location, 1); // ȴڶдļĲ
+        d_invalidate(dir_ino(current), name, type);
+        d_invalidate_inode(node_location);
+        inode_read(node_location, &cinode); // ȡinodeϢ
+
+        // ȴӵǰĿ¼ɾĿ¼
+        dir_entry_location = dir_entry_position(current->i_size - dirsiz, current);
+        disk_read(dir_entry_location, &centry, dirsiz); // ȡһĿ¼
+        disk_write(dir_entry_location, &dentry, dirsiz); // ոλ
+
+        // ͷŶݿ
+        if ((current->i_size - dirsiz) % blocksiz == 0) // һճͬҪһͷ
+            truncate_blocks(current, parent, current->i_blocks - 1);
+        current->i_size -= dirsiz;
+
+        // ɾĿһһĿ¼ɾ
+        if (j * dirsiz < current->i_size)
+        {
+            dir_entry_location = dir_entry_position(j * dirsiz, current);
+            disk_write(dir_entry_location, &centry, dirsiz);
+        }
+        if (slot >= 0)
+            dx_remove(current, slot, j, name, &centry, current->i_size / dirsiz);
+        inode_write(parent, current); // Ŀ¼inode
 
         // ɾĿ¼
         if (type == 2)
         {
+            // Ŀ¼Ѿժ£ɾʱſĿ¼Լɾеݣ
+            // ݹֻͬʱ֮õ߳̿ i_dtime ͷ ( ext2_server.c  dir_lock)
+            time(&cinode.i_dtime);
+            inode_write(node_location, &cinode);
+            inode_unlock(node_location);
+            inode_unlock(parent);
             while (cinode.i_size > 2 * dirsiz) // ɾĿ¼еݣٱǰĿ¼"."Ŀ¼
             {
-                fseek(fout, dir_entry_position(cinode.i_size - dirsiz, cinode.i_block), SEEK_SET);
-                fread(&eentry, sizeof(ext2_dir_entry), 1, fout);    
+                disk_read(dir_entry_position(cinode.i_size - dirsiz, &cinode), &eentry, sizeof(ext2_dir_entry));
                 Delete(eentry.file_type, &cinode, eentry.name); // ݹɾĿ¼ļ
             }
 
-            // ɾǰĿ¼Ŀinode
+            // ɾǰĿ¼Ŀ顢ϣinode
+            inode_lock(node_location, 1);
+            dx_release(&cinode);
             DelBlock(cinode.i_block[0]);
+            prealloc_discard(node_location); // ͷŸļδԤ
             DelInode(node_location);
-
-            // µǰĿ¼ĿɾĿ¼
-            dir_entry_location = dir_entry_position(current->i_size - dirsiz, current->i_block);
-            fseek(fout, dir_entry_location, SEEK_SET);
-            fread(&centry, dirsiz, 1, fout); // ȡһĿ¼
-            fseek(fout, dir_entry_location, SEEK_SET);
-            fwrite(&dentry, dirsiz, 1, fout); // ոλ
-
-            // ͷŶݿ
-            dir_entry_location -= data_begin_block * blocksiz;
-            if (dir_entry_location % blocksiz == 0)
-            {
-                DelBlock(dir_entry_location / blocksiz);
-                current->i_blocks--;
-                if (current->i_blocks == 6)
-                    DelBlock(current->i_block[6]);
-                else if (current->i_blocks == (blocksiz / sizeof(int) + 6))
-                {
-                    int a;
-                    fseek(fout, data_begin_block * blocksiz + current->i_block[7] * blocksiz, SEEK_SET);
-                    fread(&a, sizeof(int), 1, fout);
-                    DelBlock(a);
-                    DelBlock(current->i_block[7]);
-                }
-                else if (!((current->i_blocks - 6 - blocksiz / sizeof(int)) % (blocksiz / sizeof(int))))
-                {
-                    int a;
-                    fseek(fout, data_begin_block * blocksiz + current->i_block[7] * blocksiz + ((current->i_blocks - 6 - blocksiz / sizeof(int)) / (blocksiz / sizeof(int))), SEEK_SET);
-                    fread(&a, sizeof(int), 1, fout);
-                    DelBlock(a);
-                }
-            }
-            current->i_size -= dirsiz;
-
-            // ɾĿһһĿ¼ɾ
-            if (j * dirsiz < current->i_size)
-            {
-                dir_entry_location = dir_entry_position(j * dirsiz, current->i_block);
-                fseek(fout, dir_entry_location, SEEK_SET);
-                fwrite(&centry, dirsiz, 1, fout);
-            }
+            alloc_lock();
+            gdt[inode_group(node_location)].bg_used_dirs_count--;
+            alloc_unlock();
+            inode_unlock(node_location);
             printf("Ŀ¼ %s ɾ!\n", name);
+            return stat_leave(&sc, 0);
         }
-        // ɾļ
-        else
-        {
-            // ɾֱָĿ
-            for (i = 0; i < 6; i++)
-            {
-                if (cinode.i_blocks == 0)
-                    break;
-                block_location = cinode.i_block[i];
-                DelBlock(block_location); // ɾ
-                cinode.i_blocks--;
-            }
 
-            // ɾһеĿ
-            if (cinode.i_blocks > 0)
-            {
-                block_location = cinode.i_block[6];
-                fseek(fout, (data_begin_block + block_location) * blocksiz, SEEK_SET);
-                for (i = 0; i < blocksiz / sizeof(int); i++)
-                {
-                    if (cinode.i_blocks == 0)
-                        break;
-                    fread(&block_location2, sizeof(int), 1, fout);
-                    DelBlock(block_location2); // ɾ
-                    cinode.i_blocks--;
-                }
-                DelBlock(block_location); // ɾһ
-            }
+        // ɾļͷȫݿ飬ɾļinode
+        truncate_blocks(&cinode, node_location, 0);
+        DelInode(node_location);
+        printf("ļ %s ɾ!\n", name);
+        inode_unlock(node_location);
+        inode_unlock(parent);
+        return stat_leave(&sc, 0);
+    }
+    inode_unlock(parent);
+    return stat_leave(&sc, 1); // δҵĿļĿ¼
+}
 
-            // ɾеĿ
-            if (cinode.i_blocks > 0)
-            {
-                block_location = cinode.i_block[7];
-                for (i = 0; i < blocksiz / sizeof(int); i++)
-                {
-                    fseek(fout, (data_begin_block + block_location) * blocksiz + i * sizeof(int), SEEK_SET);
-                    fread(&block_location2, sizeof(int), 1, fout);
-                    fseek(fout, (data_begin_block + block_location2) * blocksiz, SEEK_SET);
-                    for (k = 0; i < blocksiz / sizeof(int); k++)
-                    {
-                        if (cinode.i_blocks == 0)
-                            break;
-                        fread(&block_location3, sizeof(int), 1, fout);
-                        DelBlock(block_location3); // ɾ
-                        cinode.i_blocks--;
-                    }
-                    DelBlock(block_location2); // ɾ
-                }
-                DelBlock(block_location); // ɾһ
-            }
+/**********ļӿ**********/
+/********** Ext2.c ʹãļõ֮ƫд shell**********/
+// ֻ¼ڵţÿζдڵ㻺ȡµڵ㣬ӸļĶд
+// ļ Delete ɾָľʧЧɵ֤߱ʹ
+#define EXT2SIM_MAX_FILES 64   // ͬʱ򿪵ļ
+#define EXT2SIM_CREAT 1        // ext2sim_open ı־ļʱ
+#define EXT2SIM_TRUNC 2        // ext2sim_open ı־򿪺ضΪ 0 ֽ
+
+// 򿪵ļ
+typedef struct ext2sim_file {
+    int used;                  // Ƿʹ
+    int ino;                   // ļڵ
+} ext2sim_file;
+
+ext2sim_file ext2sim_files[EXT2SIM_MAX_FILES];                // ±
+pthread_mutex_t ext2sim_mutex = PTHREAD_MUTEX_INITIALIZER;    // 
+
+/*ȡþ fd ӦڵţЧʱ -1*/
+int ext2sim_ino(int fd)
+{
+    int ino = -1;
+    pthread_mutex_lock(&ext2sim_mutex);
+    if (fd >= 0 && fd < EXT2SIM_MAX_FILES && ext2sim_files[fd].used)
+        ino = ext2sim_files[fd].ino;
+    pthread_mutex_unlock(&ext2sim_mutex);
+    return ino;
+}
 
-            // ɾļinode
-            DelInode(node_location);
-            // µǰĿ¼Ŀ
-            dir_entry_location = dir_entry_position(current->i_size - dirsiz, current->i_block);
-            fseek(fout, dir_entry_location, SEEK_SET);
-            fread(&centry, dirsiz, 1, fout); // ȡһĿ¼
-            fseek(fout, dir_entry_location, SEEK_SET);
-            fwrite(&dentry, dirsiz, 1, fout); // ոλ
-
-            // ͷݿ
-            dir_entry_location -= data_begin_block * blocksiz;
-            if (dir_entry_location % blocksiz == 0)
-            {
-                DelBlock(dir_entry_location / blocksiz);
-                current->i_blocks--;
-                if (current->i_blocks == 6)
-                    DelBlock(current->i_block[6]);
-                else if (current->i_blocks == (blocksiz / sizeof(int) + 6))
-                {
-                    int a;
-                    fseek(fout, data_begin_block * blocksiz + current->i_block[7] * blocksiz, SEEK_SET);
-                    fread(&a, sizeof(int), 1, fout);
-                    DelBlock(a);
-                    DelBlock(current->i_block[7]);
-                }
-                else if (!((current->i_blocks - 6 - blocksiz / sizeof(int)) % (blocksiz / sizeof(int))))
-                {
-                    int a;
-                    fseek(fout, data_begin_block * blocksiz + current->i_block[7] * blocksiz + ((current->i_blocks - 6 - blocksiz / sizeof(int)) / (blocksiz / sizeof(int))), SEEK_SET);
-                    fread(&a, sizeof(int), 1, fout);
-                    DelBlock(a);
-                }
-            }
-            current->i_size -= dirsiz;
+/* ino ļĴСΪ sizeСʱͷŶĿ飬ʱǿնݿ (ļ)
+  ߳иļдɹ 0ļ󳤶Ȼռ䲻㷵 1*/
+int resize_file(ext2_inode *node, int ino, int size)
+{
+    int new_blocks = (int)(((long long)size + blocksiz - 1) / blocksiz);
+    int b, end;
+    char *zero;
+    if (size <= node->i_size)
+    {
+        truncate_blocks(node, ino, new_blocks);
+        node->i_size = size;
+        return 0;
+    }
+    if (new_blocks > 6 + blocksiz / 4 + (blocksiz / 4) * (blocksiz / 4) || inline_prepare(node, ino, size))
+        return 1;
+    if (inline_valid(node))
+    {
+        zero = calloc(1, size - node->i_size);
+        inline_copy(node, node->i_size, zero, size - node->i_size, 1);
+        free(zero);
+        node->i_size = size;
+        return 0;
+    }
+    end = (node->i_size + blocksiz - 1) / blocksiz * blocksiz; // ԭһļβ֮нضǰľ
+    if (end > size)
+        end = size;
+    if (end > node->i_size && (b = bmap(node, node->i_size / blocksiz)) != 0)
+    {
+        zero = calloc(1, blocksiz);
+        disk_write(block_pos(b) + node->i_size % blocksiz, zero, end - node->i_size);
+        free(zero);
+    }
+    node->i_size = size;
+    return 0;
+}
 
-            // ɾĿһһĿ¼ɾ
-            if (j * dirsiz < current->i_size)
-            {
-                dir_entry_location = dir_entry_position(j * dirsiz, current->i_block);
-                fseek(fout, dir_entry_location, SEEK_SET);
-                fwrite(&centry, dirsiz, 1, fout);
-            }
+/*Ϊļ [offset, offset+len) ǵĿնݿ飬ֻдһֵ¿㡣ɹ 0ռ䲻㷵 1*/
+int alloc_range(ext2_inode *node, int ino, int offset, int len)
+{
+    int first = offset / blocksiz, last = (offset + len - 1) / blocksiz, l, run;
+    int zfirst, zlast;
+    char *zero;
+    if (len <= 0 || inline_valid(node))
+        return 0;
+    zfirst = (offset % blocksiz || (first == last && (offset + len) % blocksiz)) && bmap(node, first) == 0;
+    zlast = last != first && (offset + len) % blocksiz && bmap(node, last) == 0;
+    for (l = first; l <= last; l += run) // ÿĿնһη
+        if (bmap_run(node, l, last + 1 - l, &run) == 0 && alloc_file_blocks(node, ino, l, l + run))
+            return 1;
+    zero = calloc(1, blocksiz);
+    if (zfirst)
+        disk_write(block_pos(bmap(node, first)), zero, blocksiz);
+    if (zlast)
+        disk_write(block_pos(bmap(node, last)), zero, blocksiz);
+    free(zero);
+    return 0;
+}
+
+int ext2sim_close(int fd);
+
+/* ino ļĴСΪ sizeֻ޸Ļ棬񡣳ɹ 0ռ䲻㷵 -1 (errno Ϊ ENOSPC)*/
+int ext2sim_resize(int ino, int size)
+{
+    ext2_inode node;
+    int ret;
+    inode_lock(ino, 1);
+    inode_read(ino, &node);
+    ret = resize_file(&node, ino, size) == 0 ? 0 : -1;
+    if (ret)
+        errno = ENOSPC;
+    time(&node.i_mtime);
+    inode_write(ino, &node);
+    inode_unlock(ino);
+    return ret;
+}
 
-            printf("ļ %s ɾ!\n", name);
+/*Ŀ¼ dir еļ nameflags Ϊ EXT2SIM_CREATEXT2SIM_TRUNC ϣؾʧܷ -1*/
+int ext2sim_open(ext2_inode *dir, char *name, int flags)
+{
+    ext2_dir_entry entry;
+    int fd, ret, created = 0;
+    if (lookup(dir, name, 1, &entry) < 0)
+    {
+        if (!(flags & EXT2SIM_CREAT) || strlen(name) > EXT2_NAME_LEN || Create(1, dir, name) != 0 ||
+            lookup(dir, name, 1, &entry) < 0)
+        {
+            bsync(); // Create ʧʱѾ޸˻
+            return -1;
         }
+        created = 1;
+    }
+    pthread_mutex_lock(&ext2sim_mutex);
+    for (fd = 0; fd < EXT2SIM_MAX_FILES && ext2sim_files[fd].used; fd++)
+        ;
+    if (fd < EXT2SIM_MAX_FILES)
+    {
+        ext2sim_files[fd].used = 1;
+        ext2sim_files[fd].ino = entry.inode;
+    }
+    pthread_mutex_unlock(&ext2sim_mutex);
+    ret = fd < EXT2SIM_MAX_FILES && (flags & EXT2SIM_TRUNC) ? ext2sim_resize(entry.inode, 0) : 0;
+    if (created || (flags & EXT2SIM_TRUNC))
+        bsync(); // ͽضϺΪһ
+    if (fd == EXT2SIM_MAX_FILES)
+        return -1; // 
+    if (ret != 0)
+    {
+        ext2sim_close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*ļ offset ȡ len ֽڣضֽ (ļĩβʱΪ 0)Ч -1*/
+int ext2sim_pread(int fd, void *buf, int len, int offset)
+{
+    ext2_inode node;
+    int ino = ext2sim_ino(fd), n;
+    if (ino < 0 || len < 0 || offset < 0)
+        return -1;
+    inode_lock(ino, 0);
+    inode_read(ino, &node);
+    n = read_file(&node, ino, offset, buf, len);
+    inode_unlock(ino);
+    return n;
+}
+
+/* buf е len ֽдļ offset ļĩβʱļ (мĿ϶)
+  дֽЧռ䲻㷵 -1 (ռ䲻ʱ errno Ϊ ENOSPC)*/
+int ext2sim_pwrite(int fd, const void *buf, int len, int offset)
+{
+    ext2_inode node;
+    int ino = ext2sim_ino(fd), ret = len, size;
+    if (ino < 0 || len < 0 || offset < 0 || (long long)offset + len > 0x7fffffff)
+        return -1;
+    inode_lock(ino, 1);
+    inode_read(ino, &node);
+    size = node.i_size;
+    if (offset + len > node.i_size && resize_file(&node, ino, offset + len) != 0)
+    {
+        errno = ENOSPC;
+        ret = -1;
+    }
+    else if (alloc_range(&node, ino, offset, len) != 0) // ֻΪдĿռ䣬Ĳն
+    {
+        resize_file(&node, ino, size);
+        errno = ENOSPC;
+        ret = -1;
+    }
+    else
+    {
+        write_file(&node, offset, buf, len);
+        time(&node.i_mtime);
+        node.i_atime = node.i_mtime;
+    }
+    inode_write(ino, &node);
+    inode_unlock(ino);
+    bsync(); // ÿдһ
+    return ret;
+}
+
+/*ļĴСΪ sizeɹ 0Чռ䲻㷵 -1 (ռ䲻ʱ errno Ϊ ENOSPC)*/
+int ext2sim_truncate(int fd, int size)
+{
+    int ino = ext2sim_ino(fd), ret;
+    if (ino < 0 || size < 0)
+        return -1;
+    ret = ext2sim_resize(ino, size);
+    bsync(); // ÿεһ
+    return ret;
+}
 
-        // µǰĿ¼inode
-        fseek(fout, (data_begin_block + current->i_block[0]) * blocksiz, SEEK_SET);
-        fread(&centry, sizeof(ext2_dir_entry), 1, fout);
-        fseek(fout, 3 * blocksiz + (centry.inode) * sizeof(ext2_inode), SEEK_SET);
-        fwrite(current, sizeof(ext2_inode), 1, fout); // Ŀ¼inode
+/*رվɹ 0Ч -1*/
+int ext2sim_close(int fd)
+{
+    int ret = -1;
+    pthread_mutex_lock(&ext2sim_mutex);
+    if (fd >= 0 && fd < EXT2SIM_MAX_FILES && ext2sim_files[fd].used)
+    {
+        ext2sim_files[fd].used = 0;
+        ret = 0;
     }
-    fclose(fout);
+    pthread_mutex_unlock(&ext2sim_mutex);
+    return ret;
 }
 
 /* гǰĿ¼еļĿ¼*/
 void ls(ext2_inode *current)
 {
-    ext2_dir_entry dir; // Ŀ¼
+    stat_ctx sc = stat_enter(STAT_LS);
+    ext2_dir_entry dbuf, *dir; // Ŀ¼
     int i, j;
     char timestr[150]; // ڴ洢ʱַ
-    ext2_inode node;   // ļĿ¼ڵ
+    ext2_inode nbuf, *node; // ļĿ¼ڵ
+    int parent = dir_ino(current);
 
-    // ļ
-    f = fopen(PATH, "r+");
+    inode_lock(parent, 0);
     printf("\t\tļ\t\tʱ\t\t\tʱ\t\t\t޸ʱ\n");
     printf("\nע⣡current->i_size:%d\n", current->i_size);
 
     // ǰĿ¼Ŀ
     for (i = 0; i < current->i_size / 32; i++)
     {
-        fseek(f, dir_entry_position(i * 32, current->i_block), SEEK_SET); // λĿ¼
-        fread(&dir, sizeof(ext2_dir_entry), 1, f);  // ȡĿ¼
-        fseek(f, 3 * blocksiz + dir.inode * sizeof(ext2_inode), SEEK_SET); // λڵ
-        fread(&node, sizeof(ext2_inode), 1, f);     // ȡڵ
+        if (i * 32 % blocksiz == 0) // µĿ¼
+            readahead(current, parent, i * 32 / blocksiz, 1);
+        dir = dir_entry_get(i * 32, current, &dbuf); // ȡĿ¼
+        node = inode_get(dir->inode, &nbuf);                  // ȡڵ
 
         // ʽʱַ
         strcpy(timestr, "");
-        strcat(timestr, asctime(localtime(&node.i_ctime))); // ʱ
-        strcat(timestr, asctime(localtime(&node.i_atime))); // ʱ
-        strcat(timestr, asctime(localtime(&node.i_mtime))); // ޸ʱ
+        strcat(timestr, asctime(localtime(&node->i_ctime))); // ʱ
+        strcat(timestr, asctime(localtime(&node->i_atime))); // ʱ
+        strcat(timestr, asctime(localtime(&node->i_mtime))); // ޸ʱ
 
         // 滻ʱַеĻзΪƱ
         for (j = 0; j < strlen(timestr) - 1; j++)
@@ -1013,34 +3944,40 @@ void ls(ext2_inode *current)
             }
 
         // ļĿ¼Ϣ
-        if (dir.file_type == 1)
-            printf("ļ\t\t%s\t\t%s", dir.name, timestr);
+        if (dir->file_type == 1)
+            printf("ļ\t\t%s\t\t%s", dir->name, timestr);
         else
-            printf("Ŀ¼\t\t%s\t\t%s", dir.name, timestr);
+            printf("Ŀ¼\t\t%s\t\t%s", dir->name, timestr);
     }
-
-    fclose(f); // رļ
+    inode_unlock(parent);
+    stat_leave(&sc, 0);
 }
 
 /*˺޸ļϵͳ룬޸ĳɹ򷵻 0޸ʧܻûȡ޸ģ򷵻 1*/
 int Password()
 {
     char psw[16], ch[10]; // ڴ洢ȷ޸ĵ
-    printf("룺\n");
-    scanf("%s", psw); // 뵱ǰ
-    if (strcmp(psw, group_desc.password) != 0) // ȶľ洢
+    if (!batch_mode) // ģʽӡʾ
+        printf("룺\n");
+    if (scanf("%15s", psw) != 1) // 뵱ǰ룬ʱ޸
+        return 1;
+    if (strcmp(psw, gdt[0].password) != 0) // ȶľ洢
     {
         printf("\n");
         return 1; // 󣬷 1
     }
     while (1)
     {
-        printf("룺");
-        scanf("%s", psw); // 
+        if (!batch_mode)
+            printf("룺");
+        if (scanf("%15s", psw) != 1) // 
+            return 1;
         while (1)
         {
-            printf("ȷ޸룿[Y/N]");
-            scanf("%s", ch); // Ƿȷ޸
+            if (!batch_mode)
+                printf("ȷ޸룿[Y/N]");
+            if (scanf("%9s", ch) != 1) // Ƿȷ޸룬ʱΪȡ
+                return 1;
             if (ch[0] == 'N' || ch[0] == 'n') // ûѡȡ޸
             {
                 printf("ȡ޸\n");
@@ -1048,11 +3985,8 @@ int Password()
             }
             else if (ch[0] == 'Y' || ch[0] == 'y') // ûȷ޸
             {
-                strcpy(group_desc.password, psw); // 
-                f = fopen(PATH, "r+"); // ´ļ
-                fseek(f, 0, 0); // λļͷ
-                fwrite(&group_desc, sizeof(ext2_group_desc), 1, f); // µ
-                fclose(f);
+                strcpy(gdt[0].password, psw); // 
+                disk_write(0, &gdt[0], sizeof(ext2_group_desc)); // µ
                 return 0; // ޸ĳɹ 0
             }
             else
@@ -1063,27 +3997,21 @@ int Password()
 
  /*ʾǰĿ¼ľ·*/ 
 void pwd (char *str, ext2_inode *current) {
-    FILE *fout = NULL;
+    stat_ctx sc = stat_enter(STAT_PWD);
     char string[100]; // ڴ洢·ַ
     char *slash = "/"; // ƴ·ʱķָ
 
-    int node_location, dir_entry_location, block_location;
     ext2_inode cinode; // ǰĿ¼inodeṹ
     ext2_dir_entry pentry, centry;  // ϼĿ¼ĿǰĿ¼Ŀ
 
-    fout = fopen(PATH, "r+"); // ļϵͳ
-
     // λǰĿ¼"."ĿǰĿ¼
-    fseek(fout, (data_begin_block + current->i_block[0]) * blocksiz, SEEK_SET); 
-    fread(&centry, sizeof(ext2_dir_entry), 1, fout); // ȡǰĿ¼ĿϢ
+    disk_read(block_pos(current->i_block[0]), &centry, sizeof(ext2_dir_entry)); // ȡǰĿ¼ĿϢ
 
     // λǰĿ¼".."ĿһĿ¼
-    fseek(fout, (data_begin_block + current->i_block[0]) * blocksiz + dirsiz, SEEK_SET); 
-    fread(&pentry, sizeof(ext2_dir_entry), 1, fout); // ȡһĿ¼ĿϢ
+    disk_read(block_pos(current->i_block[0]) + dirsiz, &pentry, sizeof(ext2_dir_entry)); // ȡһĿ¼ĿϢ
 
     // λһĿ¼inodeȡinodeϢ
-    fseek(fout, 3 * blocksiz + (pentry.inode) * sizeof(ext2_inode), SEEK_SET);  
-    fread(&cinode, sizeof(ext2_inode), 1, fout); // ȡһĿ¼inodeϢ
+    inode_read(pentry.inode, &cinode); // ȡһĿ¼inodeϢ
 
     // ȡһĿ¼·浽string
     getstring(string, cinode);
@@ -1101,48 +4029,89 @@ void pwd (char *str, ext2_inode *current) {
         // ݹpwdϲһĿ¼
         pwd(str, current);
     }
+    stat_leave(&sc, 0);
 }
 
-/*ʽģļϵͳʼλͼ͸Ŀ¼current ָ ext2_inode ͵ָ룬ָĿ¼ 0ʾɹ*/
-int format(ext2_inode *current)
+/*ʽģļϵͳʼλͼ͸Ŀ¼current ָ ext2_inode ͵ָ룬ָĿ¼
+  bs ΪСvolume ΪС (ֽڣ0 ʾֻһ) 0ʾɹСϷ޷̷ 1
+  (һԭѾرգdisk_fd Ϊ -1)*/
+int format(ext2_inode *current, int bs, long long volume)
 {
-    FILE *fp = NULL;
-    int i;
-    unsigned int zero[blocksiz / 4];                // 
+    int g, i;
+    unsigned int *bits;                             // λͼ
     time_t now;
     time(&now);                                     // ȡǰʱ
-    // ֤ļ򿪳ɹ
-    while (fp == NULL)
-        fp = fopen(PATH, "w+");                     // ļдģʽ
-    // ʼ
-    for (i = 0; i < blocksiz / 4; i++)
-        zero[i] = 0;
-    // ݿ飬ʼΪ
-    for (i = 0; i < blocks; i++)                   
-    {
-        fseek(fp, i * blocksiz, SEEK_SET);          // λʼλ
-        fwrite(&zero, blocksiz, 1, fp);            // д
-    }
-    // ʼ
-    strcpy(group_desc.bg_volume_name, "Volume_name"); // þ
-    group_desc.bg_block_bitmap = 1;                  // λͼڿ
-    group_desc.bg_inode_bitmap = 2;                  // ڵλͼڿ
-    group_desc.bg_inode_table = 3;                   // ڵʼ
-    group_desc.bg_free_blocks_count = 4095;          // ÿȥĿ¼ռÿ飩
-    group_desc.bg_free_inodes_count = 4095;          // ڵ
-    group_desc.bg_used_dirs_count = 1;               // Ŀ¼
-    strcpy(group_desc.password, "9331");                   // Ĭ
-    
-    // дһ
-    fseek(fp, 0, SEEK_SET);
-    fwrite(&group_desc, sizeof(ext2_group_desc), 1, fp);
-
-    // ʼλͼڵλͼһλΪ
-    zero[0] = 0x80000000;                           
-    fseek(fp, 1 * blocksiz, SEEK_SET);
-    fwrite(&zero, blocksiz, 1, fp);                 // дλͼ
-    fseek(fp, 2 * blocksiz, SEEK_SET);
-    fwrite(&zero, blocksiz, 1, fp);                 // дڵλͼ
+    if (geometry_format(bs, volume) != 0)
+    {
+        printf("С %d  %d ֮ 2 ݣҾ %d ݿ\n", MIN_BLOCKSIZ, MAX_BLOCKSIZ, MIN_GROUP_BLOCKS);
+        return 1;
+    }
+    // ɵĿ黺ڴӳ䣬дģʽ¹ (֤ļ򿪳ɹ)
+    unmap_disk();
+    if (disk_fd >= 0)
+        close(disk_fd);
+    if (mount_disk(O_RDWR | O_CREAT | O_TRUNC) != 0)
+    {
+        perror(PATH);
+        return 1;
+    }
+    journal_active = 0; // ʽڼֱдأ־
+    last_allco_inode = 0;
+    last_allco_block = 0;
+    // յļչ (֮־)дݣδдĲֶΪ㡣
+    // ֻдλͼ͸Ŀ¼ڵΪն
+    if (ftruncate(disk_fd, (off_t)(blocks + JOURNAL_BLOCKS) * blocksiz) != 0)
+    {
+        perror(PATH);
+        close(disk_fd);
+        disk_fd = -1;
+        return 1;
+    }
+    if (mount_mmap)                                 // ļСʱܽӳ
+        map_disk();
+    // ʼ 0 ĵһݿ͵һڵڸĿ¼
+    for (g = 0; g < groups_count; g++)
+    {
+        gdt[g].bg_block_bitmap = bitmap_block(g, 0);               // λͼڿ
+        gdt[g].bg_inode_bitmap = bitmap_block(g, 1);               // ڵλͼڿ
+        gdt[g].bg_inode_table = group_first_block(g) + 2;          // ڵʼ
+        gdt[g].bg_free_blocks_count = group_blocks(g) - (g == 0);  // ÿȥĿ¼ռÿ飩
+        gdt[g].bg_free_inodes_count = inodes_per_group - (g == 0); // ڵ
+        gdt[g].bg_used_dirs_count = g == 0;                        // Ŀ¼
+        gdt[g].bg_flags = EXT2_BG_ITABLE_UNINIT;                   // ڵлûзڵ
+        gdt[g].bg_itable_unused = inodes_per_group;
+    }
+    strcpy(gdt[0].bg_volume_name, "Volume_name");   // þ
+    strcpy(gdt[0].password, "9331");                // Ĭ
+    gdt[0].bg_magic = EXT2_GD_MAGIC;
+    gdt[0].bg_journal_block = blocks;               // ־һ֮
+    gdt[0].bg_journal_blocks = JOURNAL_BLOCKS;
+    gdt[0].bg_block_size = blocksiz;                // βʱ geometry_load 
+    gdt[0].bg_groups = groups_count;
+    gdt[0].bg_inodes_per_group = inodes_per_group;
+    itable_mark(0);                                 // Ŀ¼ռ 0 ڵ
+
+    // дĿͷ
+    disk_write(0, gdt, groups_count * sizeof(ext2_group_desc));
+
+    // ʼĿλͼڵλͼ 0 ĵһλΪãݿڵλҲΪ
+    bits = calloc(1, blocksiz);
+    for (g = 0; g < groups_count; g++)
+    {
+        memset(bits, 0, blocksiz);
+        bits[0] = g == 0 ? 0x80000000 : 0;
+        for (i = group_blocks(g); i < blocksiz * 8; i++)
+            bits[i / 32] |= 0x80000000u >> (i % 32);
+        disk_write(bitmap_block(g, 0) * blocksiz, bits, blocksiz); // дλͼ
+        memset(bits, 0, blocksiz);
+        bits[0] = g == 0 ? 0x80000000 : 0;
+        for (i = inodes_per_group; i < blocksiz * 8; i++)
+            bits[i / 32] |= 0x80000000u >> (i % 32);
+        disk_write(bitmap_block(g, 1) * blocksiz, bits, blocksiz); // дڵλͼ
+    }
+    free(bits);
+    alloc_init();                                   // 볣פڴλͼ
+    dcache_init();                                  // Ŀ¼
 
     // ʼڵøĿ¼ڵϢ
     inode.i_mode = 2;                               // Ŀ¼
@@ -1152,8 +4121,7 @@ int format(ext2_inode *current)
     inode.i_atime = now;                            // ʱ
     inode.i_mtime = now;                            // ޸ʱ
     inode.i_dtime = 0;                              // ɾʱ䣨δɾ
-    fseek(fp, 3 * blocksiz, SEEK_SET);
-    fwrite(&inode, sizeof(ext2_inode), 1, fp);      // дڵ
+    disk_write(inode_pos(0), &inode, sizeof(ext2_inode)); // дڵ
 
     // ʼĿ¼ "."  ".." Ŀ¼
     dir.inode = 0;                                  // ǰĿ¼ inode 
@@ -1161,23 +4129,22 @@ int format(ext2_inode *current)
     dir.name_len = 1;                               // Ƴ
     dir.file_type = 2;                              // ͣĿ¼
     strcpy(dir.name, ".");                          // ǰĿ¼
-    fseek(fp, data_begin_block * blocksiz, SEEK_SET);
-    fwrite(&dir, sizeof(ext2_dir_entry), 1, fp);    // д뵱ǰĿ¼
+    disk_write(block_pos(0), &dir, sizeof(ext2_dir_entry));    // д뵱ǰĿ¼
 
     dir.inode = 0;                                  // Ŀ¼ϼĿ¼Ϊ
     dir.rec_len = 32;
     dir.name_len = 2;                               // Ƴ
     dir.file_type = 2;                              // ͣĿ¼
     strcpy(dir.name, "..");                         // ϼĿ¼
-    fseek(fp, data_begin_block * blocksiz + dirsiz, SEEK_SET);
-    fwrite(&dir, sizeof(ext2_dir_entry), 1, fp);    // дϼĿ¼
+    disk_write(block_pos(0) + dirsiz, &dir, sizeof(ext2_dir_entry));    // дϼĿ¼
 
     // óʼõǰĿ¼ָΪĿ¼
     initialize(current);
 
     // ӡĿ¼ inode СϢ
     printf("\nע⣡inode.i_size:%d\n", inode.i_size);
-    fclose(fp);                                     // رļ
+    bsync();                                        // дظʽ
+    journal_init();                                 // ֮޸ľ־д
     return 0;
 }
 
@@ -1187,25 +4154,39 @@ int format(ext2_inode *current)
 /*ģ Shell һѭȴûݲִͬӦĲ */
 void shellloop(ext2_inode currentdir)
 {
-    char command[10], var1[10], var2[128], path[10];
+    char command[10], var1[10], var2[128], var3[128], path[10];
     ext2_inode temp;
-    int i, j;
+    int i, j, rc, seq = 0;
     char currentstring[20];
+    double t0;
     // 洢ֵ֧
-    char ctable[14][10] = {"create", "delete", "cd", "close", "read", "write", "password", "format", "exit", "login", "logout", "ls", "pwd", "help"};
+    char ctable[19][10] = {"create", "delete", "cd", "close", "read", "write", "password", "format", "exit", "login", "logout", "ls", "pwd", "help", "sync", "readperf", "import", "export", "stats"};
 
+    if (batch_mode) // ɶĺʱͷš (0 ɹ)ʱ ()
+        fprintf(stderr, "seq\tcommand\trc\tseconds\n");
     // ѭȴû
     while (1)
     {
-        // ȡǰĿ¼Ʋӡʾ
-        getstring(currentstring, currentdir); 
-        printf("\n[ǰĿ¼: %s]> ", currentstring);
+        // ȡǰĿ¼Ʋӡʾ (ģʽӡ)
+        if (!batch_mode)
+        {
+            getstring(currentstring, currentdir);
+            printf("\n[ǰĿ¼: %s]> ", currentstring);
+        }
 
-        // ȡû
-        scanf("%s", command);
+        // ȡûʱ˳
+        if (scanf("%9s", command) != 1)
+            return;
+        if (batch_mode && command[0] == '#') // űеע
+        {
+            batch_skip_line();
+            continue;
+        }
+        rc = 0;
+        t0 = now_sec();
 
         // ҵӦ
-        for (i = 0; i < 14; i++)
+        for (i = 0; i < 19; i++)
             if (!strcmp(command, ctable[i]))
                 break;
 
@@ -1214,6 +4195,7 @@ void shellloop(ext2_inode currentdir)
         {
             scanf("%s", var1); // ͣf: ļ, d: Ŀ¼
             scanf("%s", var2); // ļ/Ŀ¼
+            j = 0;
             if (var1[0] == 'f')
                 j = 1; // ļ
             else if (var1[0] == 'd')
@@ -1221,19 +4203,21 @@ void shellloop(ext2_inode currentdir)
             else
             {
                 printf(": һ [f/d]\n");
-                continue;
+                rc = 1;
             }
 
-            if (i == 0) // 
+            if (j == 0) // 
+                ;
+            else if (i == 0) // 
             {
-                if (Create(j, &currentdir, var2) == 1)
+                if ((rc = Create(j, &currentdir, var2)) == 1)
                     printf("ʧ: ޷ %s\n", var2);
                 else
                     printf("ɹ:  %s\n", var2);
             }
             else // ɾ
             {
-                if (Delete(j, &currentdir, var2) == 1)
+                if ((rc = Delete(j, &currentdir, var2)) == 1)
                     printf("ʧ: ޷ɾ %s\n", var2);
                 else
                     printf("ɹ: ɾ %s\n", var2);
@@ -1255,6 +4239,7 @@ void shellloop(ext2_inode currentdir)
                     else if (i == 0) // Ŀ¼вܰ '/'
                     {
                         printf("·!\n");
+                        rc = 1;
                         break;
                     }
                     else // ָĿ¼
@@ -1264,6 +4249,7 @@ void shellloop(ext2_inode currentdir)
                         {
                             printf("·!\n");
                             currentdir = temp;
+                            rc = 1;
                         }
                     }
                     i = 0; // ·
@@ -1276,6 +4262,7 @@ void shellloop(ext2_inode currentdir)
                     {
                         printf("·!\n");
                         currentdir = temp;
+                        rc = 1;
                     }
                     break;
                 }
@@ -1291,48 +4278,61 @@ void shellloop(ext2_inode currentdir)
                 if (Close(&currentdir) == 1)
                 {
                     printf(":  %d ˴򿪵ļ\n", i);
+                    rc = 1;
                     break;
                 }
         }
         else if (i == 4) // ȡļ
         {
             scanf("%s", var2); // ļ
-            if (Read(&currentdir, var2) == 1)
+            if ((rc = Read(&currentdir, var2)) == 1)
                 printf("ʧ: ޷ȡļ %s\n", var2);
         }
         else if (i == 5) // дļ
         {
-            printf("ҪдݣESC\n");
-            scanf("%s", var2); // ļ
-            if (Write(&currentdir, var2) == 1)
+            if (!batch_mode)
+                printf("ҪдݣESC\n");
+            scanf("%s", var2); // ļ (ģʽݴһпʼһ "." )
+            if ((rc = Write(&currentdir, var2)) == 1)
                 printf("ʧ: ޷дļ %s\n", var2);
         }
         else if (i == 6) // ޸
-            Password();
+            rc = Password();
         else if (i == 7) //ʽ
         {
-            while (1)
+            while (!batch_mode) // ģʽȷ
             {
                 printf("Do you want to format the filesystem?\n It will be dangerous to your data.\n");
                 printf("[Y/N]");
-                scanf("%s", var1);
+                if (scanf("%9s", var1) != 1) // ʽ˳
+                    return;
                 if (var1[0] == 'N' || var1[0] == 'n')
                     break;
                 else if (var1[0] == 'Y' || var1[0] == 'y')
                 {
-                    format(&currentdir);
+                    rc = format(&currentdir, format_blocksiz, format_volume);
                     break;
                 }
                 else
                     printf("please input [Y/N]");
             }
+            if (batch_mode)
+                rc = format(&currentdir, format_blocksiz, format_volume);
+            if (rc != 0 && disk_fd < 0) // Ѿرգ޷
+                return;
         }
        else if (i == 8) // exit - ˳ļϵͳ
         {
+            if (batch_mode) // ģʽȷ
+            {
+                fprintf(stderr, "%d\t%s\t0\t%.6f\n", ++seq, command, now_sec() - t0);
+                return;
+            }
             while (1)
         {
         printf("ȷҪ˳ļϵͳ[Y/N]\n");
-        scanf("%s", var2); // ȡû
+        if (scanf("%127s", var2) != 1) // ʱֱ˳
+            return;
         if (var2[0] == 'N' || var2[0] == 'n') // ûѡ˳
             break;
         else if (var2[0] == 'Y' || var2[0] == 'y') // ûѡ˳
@@ -1347,8 +4347,14 @@ void shellloop(ext2_inode currentdir)
         {
             while (i)
             {
+        if (batch_mode) // ģʽȷ
+            strcpy(var1, "y");
+        else
+        {
         printf("ȷҪļϵͳ˳[Y/N]"); // ʾûǷ˳
-        scanf("%s", var1); // ȡû
+        if (scanf("%9s", var1) != 1) // ʱֱ˳
+            return;
+        }
         if (var1[0] == 'N' || var1[0] == 'n') // ûѡ˳
             break;
         else if (var1[0] == 'Y' || var1[0] == 'y') // ûѡ˳
@@ -1356,8 +4362,10 @@ void shellloop(ext2_inode currentdir)
             initialize(&currentdir); // ³ʼļϵͳ
             while (1)
             {
-                printf(": ");
-                scanf("%s", var2); // ȡû
+                if (!batch_mode)
+                    printf(": ");
+                if (scanf("%127s", var2) != 1) // ȡûʱ˳
+                    return;
                 if (strcmp(var2, "login") == 0) //  "login" 
                 {
                     if (login() == 0) // õ¼¼ɹ
@@ -1402,20 +4410,94 @@ void shellloop(ext2_inode currentdir)
             printf("* 09.رļ  : close+         10.޸   : password                       *\n");
             printf("* 11.гĿ  : ls                 12.˵   : help                           *\n");
             printf("* 13.ʽ: format             14.˳ϵͳ   : exit                           *\n");
-            printf("* 15.עϵͳ  : logout                                                            *\n");
+            printf("* 15.עϵͳ  : logout             16.ͬ   : sync                           *\n");
+            printf("* 17.ȡ  : readperf+ļ    18.ļ   : import+ļ+ļ       *\n");
+            printf("* 19.ļ  : export+ļ+ļ                                          *\n");
+            printf("* 20.I/O ͳ  : stats                                                             *\n");
             printf("************************************************************************************\n");
         }
+        else if (i == 14) // sync - ˢµ㣬ȴ޸д
+            disk_flush();
+        else if (i == 15) // readperf - Աֶȡʽ
+        {
+            scanf("%s", var2); // ļ
+            if ((rc = ReadPerf(&currentdir, var2)) == 1)
+                printf("ʧ: ޷ȡļ %s\n", var2);
+        }
+        else if (i == 16) // import - ļ
+        {
+            scanf("%s", var3); // ļ·
+            scanf("%s", var2); // ļ
+            if ((rc = Import(&currentdir, var3, var2)) == 1)
+                printf("ʧ: ޷ļ %s\n", var2);
+        }
+        else if (i == 17) // export - ļ
+        {
+            scanf("%s", var2); // ļ
+            scanf("%s", var3); // ļ·
+            if ((rc = Export(&currentdir, var2, var3)) == 1)
+                printf("ʧ: ޷ļ %s\n", var2);
+        }
+        else if (i == 18) // stats -  I/O ͳ
+            stats_print(stdout);
         else
         {
             printf(": Ч help 鿴ֵ֧\n");
+            rc = 1;
+        }
+        bsync(); // ÿһеĸֻ޸Ļ棬ͳһ
+        if (batch_mode)
+        {
+            fflush(stdout); // ֤ںʱ¼
+            fprintf(stderr, "%d\t%s\t%d\t%.6f\n", ++seq, command, rc, now_sec() - t0);
         }
     }
 }
 
-/*main򻯰ļϵͳ*/
-int main()
+#ifndef EXT2_NO_MAIN // Ϊⱻʱ ( ext2_bench.c)  main
+/*main򻯰ļϵͳв -m ʾڴӳģʽ*/
+int main(int argc, char *argv[])
 {
     ext2_inode cu; /* ǰû inode ṹʾûڵĿ¼ļϵͳ״̬ */
+    int i;
+
+    for (i = 1; i < argc; i++) // в
+    {
+        if (!strcmp(argv[i], "-m"))
+            mount_mmap = 1;
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            inode_flush_interval = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            journal_batch = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            format_blocksiz = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            format_volume = atoll(argv[++i]) << 20;
+        else if (!strcmp(argv[i], "-B"))
+            batch_mode = 1;
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+        {
+            batch_mode = 1;
+            if (freopen(argv[++i], "r", stdin) == NULL) // ӽűļȡ
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-n"))
+            skip_login = 1;
+        else if (!strcmp(argv[i], "-S"))
+            stat_dump = 1;
+        else if (!strcmp(argv[i], "-R"))
+            ra_enabled = 0;
+        else
+        {
+            printf("÷: %s [-m] [-i ] [-j ] [-b С] [-s СMB] [-B] [-f ű] [-n] [-S] [-R]\n  -m  ڴӳģʽ\n  -i  ڵӳдص (Ĭ 5)\n  -j  ÿ־ύϲ (Ĭ 8)\n"
+                   "  -b  ʽʱĿС (512  65536 ֮ 2 ݣĬ 512)\n  -s  ʽʱľС˻ֿ (Ĭֻһ)\n"
+                   "  -B  ģʽӱ׼ȡʾȷϣÿĺʱ׼\n  -f  ģʽӽűļȡ\n  -n  ¼\n  -S  ˳ʱѸ I/O ͳ׼\n  -R  ر˳ʵԤ\n", argv[0]);
+            return 1;
+        }
+    }
     
     // ӭϢʾû Ext2 ļϵͳ
     printf("ѽ!ӭʹҵϵͳ!\n");
@@ -1424,13 +4506,14 @@ int main()
     if (initfs(&cu) == 1)
         return 0;
 
-    // ʾûе¼
-    if (login() != 0) /* ¼ʧʱ˳ */
+    // ʾûе¼ (-n )
+    if (!skip_login && login() != 0) /* ¼ʧʱ˳ */
     {
         // ʱʾϢ˳
         printf("벻 ټ\n");
         
         // ʾ˳Ϣ
+        umount_disk();
         exitdisplay();
         
         return 0;
@@ -1439,11 +4522,13 @@ int main()
     // ¼ɹнģʽ
     shellloop(cu);
 
-    // ˳ļϵͳʾ˳Ϣ
+    // ж̣˳ļϵͳʾ˳Ϣ
+    umount_disk();
+    if (stat_dump)
+        stats_print(stderr);
     exitdisplay();
     
     // 
     return 0;
 }
-
-
+#endif
@@ -0,0 +1,337 @@
+/*Ext2 ģļϵͳ΢׼ԣ Ext2.c ֱӵ CreateOpenlookuplsDeleteļд;ӿڣ shell
+  : gcc -O2 -pthread -o ext2_bench ext2_bench.c
+  ÷: ./ext2_bench [-n ļ] [-s ļСMB] [-b С] [-v СMB] [-l ls ]
+  ڵ BENCH_DISK УӰ MY_DISKÿһһУƱָ
+  ops/롢MB/롢p50  p99 ӳ (΢)ÿβϵͳ ( /proc/self/io  syscr+syscw
+  ֻͳƶдϵͳã fsync)*/
+#define EXT2_NO_MAIN
+#define PATH "BENCH_DISK"
+#include "Ext2.c"
+
+#define BENCH_CHUNK (64 * 1024) // ˳дʱÿβֽ
+#define BENCH_RECORD 4096        // дʱÿ¼ֽ
+#define BENCH_RANDOM 2000        // дĲ
+
+// һԵͳ
+typedef struct bench_stat {
+    const char *name;   // 
+    int ops;            // ɵĲ
+    int cap;            // lat 
+    double *lat;        // ÿβĺʱ ()
+    double start;       // ʼʱ
+    double total;       // ܺʱ ()
+    long long bytes;    // дֽ
+    long long sys;      // ʼʱϵͳü
+} bench_stat;
+
+int saved_stdout = -1; // Ĭڼ䱣ı׼
+
+/*ȡۼƵĶдϵͳôʱ -1*/
+long long syscall_count()
+{
+    FILE *fp = fopen("/proc/self/io", "r");
+    char key[32];
+    long long v, sum = 0;
+    int found = 0;
+    if (fp == NULL)
+        return -1;
+    while (fscanf(fp, "%31s %lld", key, &v) == 2)
+        if (!strcmp(key, "syscr:") || !strcmp(key, "syscw:"))
+        {
+            sum += v;
+            found++;
+        }
+    fclose(fp);
+    return found == 2 ? sum : -1;
+}
+
+/*on Ϊ 1 ʱѱ׼ض /dev/null (α⺯Ĵӡ)Ϊ 0 ʱָ*/
+void bench_quiet(int on)
+{
+    int fd;
+    fflush(stdout);
+    if (on)
+    {
+        saved_stdout = dup(STDOUT_FILENO);
+        fd = open("/dev/null", O_WRONLY);
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+    else
+    {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+}
+
+/*ʼһԣ¼ cap β*/
+void bench_begin(bench_stat *st, const char *name, int cap)
+{
+    st->name = name;
+    st->ops = 0;
+    st->cap = cap;
+    st->lat = malloc(cap * sizeof(double));
+    st->bytes = 0;
+    bench_quiet(1);
+    st->sys = syscall_count();
+    st->start = now_sec();
+}
+
+/*¼һδ t0 ʼĲ*/
+void bench_op(bench_stat *st, double t0)
+{
+    if (st->ops < st->cap)
+        st->lat[st->ops++] = now_sec() - t0;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*һԲһн*/
+void bench_end(bench_stat *st)
+{
+    long long sys;
+    double p50 = 0, p99 = 0;
+    st->total = now_sec() - st->start;
+    sys = syscall_count();
+    bench_quiet(0);
+    if (st->ops > 0)
+    {
+        qsort(st->lat, st->ops, sizeof(double), cmp_double);
+        p50 = st->lat[st->ops / 2];
+        p99 = st->lat[(int)(st->ops * 0.99) < st->ops ? (int)(st->ops * 0.99) : st->ops - 1];
+    }
+    printf("%-14s\t%d\t%.0f\t", st->name, st->ops, st->ops / (st->total > 0 ? st->total : 1e-9));
+    if (st->bytes > 0)
+        printf("%.2f\t", st->bytes / 1048576.0 / (st->total > 0 ? st->total : 1e-9));
+    else
+        printf("-\t");
+    printf("%.1f\t%.1f\t", p50 * 1e6, p99 * 1e6);
+    if (sys >= 0 && st->sys >= 0 && st->ops > 0)
+        printf("%.2f\n", (double)(sys - st->sys) / st->ops);
+    else
+        printf("-\n");
+    fflush(stdout);
+    free(st->lat);
+}
+
+/* 0..n-1  (̶ӣظ)*/
+void shuffle(int *a, int n)
+{
+    int i, j, t;
+    for (i = 0; i < n; i++)
+        a[i] = i;
+    srand(9331);
+    for (i = n - 1; i > 0; i--)
+    {
+        j = rand() % (i + 1);
+        t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    ext2_inode root, big, cur;
+    ext2_dir_entry entry;
+    bench_stat st;
+    char name[16], *buf;
+    int nfiles = 2000, size_mb = 16, bs = 1024, volume_mb = 64, nls = 20;
+    int i, n, ino, fd, *order;
+    long long done, size;
+    double t0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            nfiles = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            size_mb = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            bs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-v") && i + 1 < argc)
+            volume_mb = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+            nls = atoi(argv[++i]);
+        else
+        {
+            printf("÷: %s [-n ļ] [-s ļСMB] [-b С] [-v СMB] [-l ls ]\n", argv[0]);
+            return 1;
+        }
+    }
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16); // ⺯Ĵӡвϵͳ
+    size = (long long)size_mb << 20;
+    order = malloc(nfiles * sizeof(int));
+    buf = malloc(BENCH_CHUNK);
+    for (i = 0; i < BENCH_CHUNK; i++)
+        buf[i] = 'a' + i % 26;
+
+    bench_quiet(1);
+    n = format(&root, bs, (long long)volume_mb << 20);
+    bench_quiet(0);
+    if (n != 0)
+    {
+        printf("ʽʧ: С %d, С %d MB\n", bs, volume_mb);
+        return 1;
+    }
+    printf(" %s: С %d, %d , ÿ %d ڵ, ־ %s\n", PATH, blocksiz, groups_count, inodes_per_group,
+           journal_active ? "" : "ر");
+    printf("        \t\tops/\tMB/\tp50(us)\tp99(us)\tϵͳ/\n");
+
+    bench_quiet(1);
+    Create(2, &root, "big");
+    bsync();
+    big = root;
+    Open(&big, "big");
+    bench_quiet(0);
+
+    // ͬһĿ¼д nfiles ļ (Ŀ¼ DX_MIN_ENTRIES ϣ)
+    bench_begin(&st, "create", nfiles);
+    for (i = 0; i < nfiles; i++)
+    {
+        sprintf(name, "f%d", i);
+        t0 = now_sec();
+        Create(1, &big, name);
+        bsync();
+        bench_op(&st, t0);
+    }
+    bench_end(&st);
+
+    // Ŀ¼а˳ļ
+    shuffle(order, nfiles);
+    bench_begin(&st, "lookup", nfiles);
+    for (i = 0; i < nfiles; i++)
+    {
+        sprintf(name, "f%d", order[i]);
+        t0 = now_sec();
+        lookup(&big, name, 1, &entry);
+        bench_op(&st, t0);
+    }
+    bench_end(&st);
+
+    // гĿ¼
+    bench_begin(&st, "ls", nls);
+    for (i = 0; i < nls; i++)
+    {
+        t0 = now_sec();
+        ls(&big);
+        bsync();
+        bench_op(&st, t0);
+    }
+    bench_end(&st);
+
+    // Ŀ¼ٷ (cd sub / cd ..)
+    bench_quiet(1);
+    Create(2, &big, "sub");
+    bsync();
+    bench_quiet(0);
+    bench_begin(&st, "cd", 2 * nfiles);
+    for (i = 0; i < nfiles; i++)
+    {
+        cur = big;
+        t0 = now_sec();
+        Open(&cur, "sub");
+        bench_op(&st, t0);
+        t0 = now_sec();
+        Open(&cur, "..");
+        bench_op(&st, t0);
+    }
+    bench_end(&st);
+
+    // ˳дһļ (ֱһ i_block[6]  i_block[7] )
+    bench_quiet(1);
+    Create(1, &root, "seq");
+    bsync();
+    bench_quiet(0);
+    lookup(&root, "seq", 1, &entry);
+    ino = entry.inode;
+    bench_begin(&st, "seq-write", (int)(size / BENCH_CHUNK) + 1);
+    for (done = 0; done < size; done += n)
+    {
+        ext2_inode node;
+        n = size - done < BENCH_CHUNK ? (int)(size - done) : BENCH_CHUNK;
+        t0 = now_sec();
+        inode_read(ino, &node);
+        if (alloc_file_blocks(&node, ino, (node.i_size + blocksiz - 1) / blocksiz, (node.i_size + n + blocksiz - 1) / blocksiz))
+            break; // ռ䲻
+        write_file(&node, node.i_size, buf, n);
+        node.i_size += n;
+        inode_write(ino, &node);
+        bsync();
+        bench_op(&st, t0);
+        st.bytes += n;
+    }
+    bench_end(&st);
+
+    // ˳ļ
+    bench_begin(&st, "seq-read", (int)(size / BENCH_CHUNK) + 1);
+    {
+        ext2_inode node;
+        inode_read(ino, &node);
+        for (done = 0; done < node.i_size; done += n)
+        {
+            t0 = now_sec();
+            n = read_file(&node, ino, (int)done, buf, BENCH_CHUNK);
+            bench_op(&st, t0);
+            st.bytes += n;
+            if (n <= 0)
+                break;
+        }
+    }
+    bench_end(&st);
+
+    // ͨӿڸļд롢ȡ¼
+    fd = ext2sim_open(&root, "seq", 0);
+    n = (int)(size / BENCH_RECORD);
+    bench_begin(&st, "rand-write", BENCH_RANDOM);
+    srand(9331);
+    for (i = 0; i < BENCH_RANDOM && n > 0; i++)
+    {
+        t0 = now_sec();
+        if (ext2sim_pwrite(fd, buf, BENCH_RECORD, rand() % n * BENCH_RECORD) != BENCH_RECORD)
+            break;
+        bench_op(&st, t0);
+        st.bytes += BENCH_RECORD;
+    }
+    bench_end(&st);
+    bench_begin(&st, "rand-read", BENCH_RANDOM);
+    for (i = 0; i < BENCH_RANDOM && n > 0; i++)
+    {
+        t0 = now_sec();
+        if (ext2sim_pread(fd, buf, BENCH_RECORD, rand() % n * BENCH_RECORD) != BENCH_RECORD)
+            break;
+        bench_op(&st, t0);
+        st.bytes += BENCH_RECORD;
+    }
+    bench_end(&st);
+    ext2sim_close(fd);
+
+    // ɾļ (ͷȫݿ)
+    bench_begin(&st, "delete-large", 1);
+    t0 = now_sec();
+    Delete(1, &root, "seq");
+    bsync();
+    bench_op(&st, t0);
+    bench_end(&st);
+
+    // ˳ɾĿ¼еȫļ
+    bench_begin(&st, "delete", nfiles);
+    for (i = 0; i < nfiles; i++)
+    {
+        sprintf(name, "f%d", order[i]);
+        t0 = now_sec();
+        Delete(1, &big, name);
+        bsync();
+        bench_op(&st, t0);
+    }
+    bench_end(&st);
+
+    free(buf);
+    free(order);
+    umount_disk();
+    return 0;
+}
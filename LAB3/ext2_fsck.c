@@ -0,0 +1,478 @@
+/*Ext2 ģļϵͳһԼ鹤ߣ̲߳жڵбĿ¼
+  ɴԡĿ¼Ϳӳ (ֱӡһԼαݡĿ¼ϣ)
+  ٰʵռؽλͼڵλͼеļ
+  : gcc -O2 -pthread -o ext2_fsck ext2_fsck.c
+  ÷: ./ext2_fsck [-n] [-t ߳] [ļ]
+    -n  ֻ飬޸ (Ҳط־)
+    -t  ߳ (ĬΪ CPU )
+  ڼ䲻ʹøֵ̡ e2fsck ͬ
+  0 ûз⣬1 λͼѸ4 ޷ԶĴ8 ޷򿪻ȡ*/
+const char *fsck_path = "MY_DISK"; //  (ָ)
+#define EXT2_NO_MAIN
+#define PATH fsck_path
+#include "Ext2.c"
+
+#include <stdarg.h>
+
+#define FSCK_MAX_THREADS 64 // ߳
+#define FSCK_MAX_REPORT 50  // Ĵֻ֮
+
+ext2_inode **itab = NULL;      // ڴڵ
+int *itab_count = NULL;        // ڵ (δĲֲ)
+unsigned int *used_blocks;     // ؽĿλͼ (̸ʽͬݿűַ)
+unsigned int *used_inodes;     // ؽڵλͼ (ڵűַ)
+int *dir_count;                // ʵʵĿ¼
+long inodes_scanned = 0;       // ڵ
+int files_found = 0;           // ɴͨļ
+int dirs_found = 0;            // ɴĿ¼
+int fsck_errors = 0;           // ޷ԶĴ
+pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER; // ʱ
+
+// Ŀ¼ջ̴߳ȡĿ¼Ŀ¼Ŀ¼ʱѹ
+int *dir_stack = NULL;         // ÿĿ¼ռڵšϼĿ¼ڵ
+int dir_top = 0;               // ջеĿ¼
+int dir_cap = 0;               // ջ (Ŀ¼)
+int dir_busy = 0;              // ڼĿ¼߳
+int next_group = 0;            // һڵ
+pthread_mutex_t dir_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t dir_cond = PTHREAD_COND_INITIALIZER;
+
+/*¼һ޷ԶĴǰ FSCK_MAX_REPORT */
+void fsck_error(const char *fmt, ...)
+{
+    va_list ap;
+    pthread_mutex_lock(&report_mutex);
+    if (fsck_errors++ < FSCK_MAX_REPORT)
+    {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+        putchar('\n');
+    }
+    pthread_mutex_unlock(&report_mutex);
+}
+
+/*λͼ bits λ nλǰֵ (߳̿ͬʱ)*/
+int fsck_mark(unsigned int *bits, int n)
+{
+    unsigned int mask = 0x80000000u >> (n % 32);
+    return (__sync_fetch_and_or(&bits[n / 32], mask) & mask) != 0;
+}
+
+/*ȡ n ڵ㣬ŲϷλδʱ NULL*/
+ext2_inode *fsck_inode(int n)
+{
+    int g = inode_group(n), k = n % (blocksiz * 8);
+    if (n < 0 || g >= groups_count || k >= itab_count[g])
+        return NULL;
+    return &itab[g][k];
+}
+
+/*Ǽ ino ڵռõݿ bb ǺϷݿʱ -1
+  ѱռʱ󲢷 1򷵻 0*/
+int fsck_claim(int ino, int b)
+{
+    int g = b / blocks_per_group;
+    if (b < 0 || g >= groups_count || b % blocks_per_group >= group_blocks(g))
+    {
+        fsck_error("ڵ %d:  %d ķΧ", ino, b);
+        return -1;
+    }
+    if (fsck_mark(used_blocks, b))
+    {
+        fsck_error("ڵ %d:  %d ѱļռ", ino, b);
+        return 1;
+    }
+    return 0;
+}
+
+/* b еĿŵ ptrsb Ϊ 0 (ն) 򲻺ϷʱȫΪնĿ¼вֿն*/
+void fsck_index(int ino, ext2_inode *node, int b, int *ptrs)
+{
+    if (b == 0 && node->i_mode == 2)
+        fsck_error("Ŀ¼ %d: ȱ", ino);
+    if (b == 0 || fsck_claim(ino, b) < 0)
+        memset(ptrs, 0, blocksiz);
+    else
+        disk_pread(ptrs, blocksiz, block_pos(b));
+}
+
+/* ino ļ߼ [0, i_blocks) ӳ䵽 mapͬʱǼõݿ顣նΪ 0
+  ӳ䳤ȳķΧʱ 1*/
+int fsck_map(int ino, ext2_inode *node, int *map)
+{
+    int ptrs = blocksiz / sizeof(int), n = node->i_blocks, l, k, m;
+    int *ind, *top;
+    if (n < 0 || n > 6 + ptrs + ptrs * ptrs)
+    {
+        fsck_error("ڵ %d:  %d Ϸ", ino, n);
+        return 1;
+    }
+    for (l = 0; l < n && l < 6; l++)
+        map[l] = node->i_block[l];
+    ind = malloc(blocksiz);
+    top = malloc(blocksiz);
+    if (n > 6) // һ
+    {
+        fsck_index(ino, node, node->i_block[6], ind);
+        m = n - 6 < ptrs ? n - 6 : ptrs;
+        memcpy(map + 6, ind, m * sizeof(int));
+    }
+    if (n > 6 + ptrs) // 
+    {
+        fsck_index(ino, node, node->i_block[7], top);
+        for (k = 0; k * ptrs < n - 6 - ptrs; k++)
+        {
+            fsck_index(ino, node, top[k], ind);
+            m = n - 6 - ptrs - k * ptrs < ptrs ? n - 6 - ptrs - k * ptrs : ptrs;
+            memcpy(map + 6 + ptrs + k * ptrs, ind, m * sizeof(int));
+        }
+    }
+    free(ind);
+    free(top);
+    for (l = 0; l < n; l++) // ݿ飺ͨļе 0 ǿնĿ¼ĵһ 0 ݿ
+    {
+        if (is_hole(node, map[l]))
+            continue;
+        if (map[l] == 0 && !(ino == 0 && l == 0))
+            fsck_error("Ŀ¼ %d: ߼ %d ǿն", ino, l);
+        else if (fsck_claim(ino, map[l]) < 0)
+            map[l] = 0;
+    }
+    return 0;
+}
+
+/*αӳһ*/
+void fsck_extents(int ino, ext2_inode *node, int *map)
+{
+    ext2_extent_header *eh = (ext2_extent_header *)node->i_pad;
+    ext2_extent *ex;
+    int k, l;
+    if (node->i_mode != 1 || eh->eh_magic != EXT2_PAD_EXTENT)
+        return;
+    if (eh->eh_entries > EXT2_MAX_EXTENTS)
+    {
+        fsck_error("ڵ %d:  %d Ϸ", ino, eh->eh_entries);
+        return;
+    }
+    for (k = 0; k < eh->eh_entries; k++)
+    {
+        ex = &eh->eh_ext[k];
+        for (l = 0; l < ex->ee_len; l++)
+            if (ex->ee_block + l >= node->i_blocks || map[ex->ee_block + l] != ex->ee_start + l)
+            {
+                fsck_error("ڵ %d:  %d (߼ %d, %d ) ӳ䲻", ino, k, ex->ee_block, ex->ee_len);
+                break;
+            }
+    }
+}
+
+/*ͨļ ino Ŀӳ*/
+void fsck_file(int ino, ext2_inode *node)
+{
+    int *map;
+    if (inline_valid(node))
+    {
+        if (node->i_blocks != 0 || node->i_size < 0 || node->i_size > EXT2_INLINE_MAX)
+            fsck_error("ڵ %d: ļĿ %d С %d Ϸ", ino, node->i_blocks, node->i_size);
+        return;
+    }
+    map = malloc(((long)(node->i_blocks > 0 ? node->i_blocks : 0) + 1) * sizeof(int));
+    if (fsck_map(ino, node, map) == 0)
+        fsck_extents(ino, node, map);
+    free(map);
+}
+
+/*Ŀ¼ ino (ϼĿ¼Ϊ parent) ѹĿ¼ջ*/
+void fsck_push(int ino, int parent)
+{
+    pthread_mutex_lock(&dir_mutex);
+    if (dir_top == dir_cap)
+    {
+        dir_cap = dir_cap ? dir_cap * 2 : 1024;
+        dir_stack = realloc(dir_stack, dir_cap * 2 * sizeof(int));
+    }
+    dir_stack[2 * dir_top] = ino;
+    dir_stack[2 * dir_top + 1] = parent;
+    dir_top++;
+    pthread_cond_signal(&dir_cond);
+    pthread_mutex_unlock(&dir_mutex);
+}
+
+/*Ŀ¼ ino Ŀӳ䡢ϣÿĿ¼Ǽڵ㣬ͨļ飬Ŀ¼ѹĿ¼ջ*/
+void fsck_dir(int ino, int parent)
+{
+    ext2_inode *node = fsck_inode(ino), *child;
+    ext2_dx_root *dx;
+    ext2_dir_entry *ents, *e;
+    int n, per = blocksiz / dirsiz, i, k, *map;
+    unsigned int sum = 0;
+    if (node == NULL || node->i_mode != 2) // Ŀ¼ڵ (Ŀ¼ѹջǰѼ)
+    {
+        fsck_error("ڵ %d Ŀ¼", ino);
+        return;
+    }
+    dx = (ext2_dx_root *)node->i_pad;
+    n = node->i_size / dirsiz;
+    if (node->i_size < 2 * dirsiz || node->i_size % dirsiz || node->i_blocks < (node->i_size + blocksiz - 1) / blocksiz)
+    {
+        fsck_error("Ŀ¼ %d: С %d  %d Ϸ", ino, node->i_size, node->i_blocks);
+        return;
+    }
+    map = malloc(((long)node->i_blocks + 1) * sizeof(int));
+    if (fsck_map(ino, node, map) != 0)
+    {
+        free(map);
+        return;
+    }
+    if (dx->dx_magic == EXT2_PAD_DXDIR) // ϣռõ
+    {
+        if (dx->dx_bits > 24)
+            fsck_error("Ŀ¼ %d: ϣС 2^%d Ϸ", ino, dx->dx_bits);
+        else
+            for (k = 0; k < dx_table_blocks(dx); k++)
+                if (fsck_claim(ino, dx->dx_block + k) < 0)
+                    break;
+    }
+    ents = malloc(blocksiz);
+    for (i = 0; i < n; i++)
+    {
+        if (i % per == 0)
+        {
+            if (map[i / per] == 0 && !(ino == 0 && i == 0)) // նǷţѱ
+                memset(ents, 0, blocksiz);
+            else
+                disk_pread(ents, blocksiz, block_pos(map[i / per]));
+        }
+        e = &ents[i % per];
+        if (e->name_len < 1 || e->name_len > EXT2_NAME_LEN || memchr(e->name, 0, EXT2_NAME_LEN) == NULL)
+        {
+            fsck_error("Ŀ¼ %d:  %d ļϷ", ino, i);
+            continue;
+        }
+        sum += dx_term(e->name, i);
+        if (i < 2) // "."  ".."
+        {
+            if (strcmp(e->name, i ? ".." : ".") || e->inode != (i ? parent : ino))
+                fsck_error("Ŀ¼ %d:  %d ӦΪָ %d  \"%s\"", ino, i, i ? parent : ino, i ? ".." : ".");
+            continue;
+        }
+        if ((child = fsck_inode(e->inode)) == NULL)
+        {
+            fsck_error("Ŀ¼ %d: \"%s\" ָ򲻴ڵڵ %d", ino, e->name, e->inode);
+            continue;
+        }
+        if (child->i_mode != e->file_type || (e->file_type != 1 && e->file_type != 2))
+        {
+            fsck_error("Ŀ¼ %d: \"%s\"  %d ڵ %d  %d ", ino, e->name, e->file_type, e->inode,
+                       child->i_mode);
+            continue;
+        }
+        if (fsck_mark(used_inodes, e->inode))
+        {
+            fsck_error("Ŀ¼ %d: \"%s\" ָڵ %d ѱĿ¼", ino, e->name, e->inode);
+            continue;
+        }
+        if (child->i_mode == 2)
+        {
+            __sync_fetch_and_add(&dir_count[inode_group(e->inode)], 1);
+            __sync_fetch_and_add(&dirs_found, 1);
+            fsck_push(e->inode, ino);
+        }
+        else
+        {
+            __sync_fetch_and_add(&files_found, 1);
+            fsck_file(e->inode, child);
+        }
+    }
+    free(ents);
+    free(map);
+    if (dx->dx_magic == EXT2_PAD_DXDIR && dx->dx_count == n && dx->dx_csum != sum) // 󣺲ʱֲᷢɨ
+        printf("Ŀ¼ %d: ϣУĿ¼ʱʹ´βʱؽ\n", ino);
+}
+
+/*̣߳ȷڵȫĿ¼ջȡĿ¼飬ջû߳ڼĿ¼ʱ*/
+void *fsck_worker(void *arg)
+{
+    pthread_barrier_t *barrier = arg;
+    int g, count, ino, parent;
+    while ((g = __sync_fetch_and_add(&next_group, 1)) < groups_count)
+    {
+        count = inodes_per_group;
+        if (gdt[0].bg_magic == EXT2_GD_MAGIC && (gdt[g].bg_flags & EXT2_BG_ITABLE_UNINIT)) // δĲֲõڵ
+            count -= gdt[g].bg_itable_unused;
+        if (count < 0)
+            count = 0;
+        itab[g] = malloc(((long)count + 1) * sizeof(ext2_inode));
+        disk_pread(itab[g], (size_t)count * sizeof(ext2_inode), inode_pos((long)g * blocksiz * 8));
+        itab_count[g] = count;
+        __sync_fetch_and_add(&inodes_scanned, count);
+    }
+    pthread_barrier_wait(barrier);
+    for (;;)
+    {
+        pthread_mutex_lock(&dir_mutex);
+        while (dir_top == 0 && dir_busy > 0)
+            pthread_cond_wait(&dir_cond, &dir_mutex);
+        if (dir_top == 0) // Ŀ¼Ѽ
+        {
+            pthread_cond_broadcast(&dir_cond);
+            pthread_mutex_unlock(&dir_mutex);
+            return NULL;
+        }
+        dir_top--;
+        ino = dir_stack[2 * dir_top];
+        parent = dir_stack[2 * dir_top + 1];
+        dir_busy++;
+        pthread_mutex_unlock(&dir_mutex);
+        fsck_dir(ino, parent);
+        pthread_mutex_lock(&dir_mutex);
+        if (--dir_busy == 0 && dir_top == 0)
+            pthread_cond_broadcast(&dir_cond);
+        pthread_mutex_unlock(&dir_mutex);
+    }
+}
+
+/*˶Ե g  kind λͼ (0: λͼ 1: ڵλͼ)expect Ϊؽλͼ (鷶ΧλѱΪ)
+  һʱ죬fix Ϊ 1 ʱдأزһµλ*/
+int fsck_bitmap(int g, int kind, unsigned int *expect, int fix)
+{
+    unsigned int *disk = malloc(blocksiz), mask;
+    int i, lost = 0, leaked = 0, valid = kind ? inodes_per_group : group_blocks(g);
+    disk_pread(disk, blocksiz, bitmap_block(g, kind) * blocksiz);
+    for (i = 0; i < valid; i++)
+    {
+        mask = 0x80000000u >> (i % 32);
+        if ((disk[i / 32] & mask) && !(expect[i / 32] & mask))
+            leaked++;
+        else if (!(disk[i / 32] & mask) && (expect[i / 32] & mask))
+            lost++;
+    }
+    if (lost || leaked)
+        printf(" %d %sλͼ: %d õ%sΪУ%d δõ%sΪ\n", g, kind ? "ڵ" : "", lost,
+               kind ? "ڵ" : "", leaked, kind ? "ڵ" : "");
+    if ((lost || leaked || memcmp(disk, expect, blocksiz)) && fix)
+        disk_pwrite(expect, blocksiz, bitmap_block(g, kind) * blocksiz);
+    free(disk);
+    return lost + leaked;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t tids[FSCK_MAX_THREADS];
+    pthread_barrier_t barrier;
+    unsigned int *expect;
+    ext2_group_desc gd;
+    int nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN), fix = 1, repaired = 0, desc_changed = 0;
+    int i, g, n, used_i, used_b;
+    long total_used = 0, total_blocks = 0;
+    double t0, t_check;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n"))
+            fix = 0;
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            nthreads = atoi(argv[++i]);
+        else if (argv[i][0] != '-')
+            fsck_path = argv[i];
+        else
+        {
+            printf("÷: %s [-n] [-t ߳] [ļ]\n  -n  ֻ飬޸\n  -t  ߳ (ĬΪ CPU )\n", argv[0]);
+            return 8;
+        }
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > FSCK_MAX_THREADS)
+        nthreads = FSCK_MAX_THREADS;
+
+    if (mount_disk(fix ? O_RDWR : O_RDONLY) != 0 || disk_pread(&gd, sizeof(gd), 0) != sizeof(gd))
+    {
+        perror(fsck_path);
+        return 8;
+    }
+    if (fix && (n = journal_recover()) > 0) // ط־ύ޸
+        printf("־ָ: ط %d \n", n);
+    disk_pread(gdt, groups_count * sizeof(ext2_group_desc), 0);
+    printf("%s: С %d, %d , ÿ %d ڵ, %d ߳\n", fsck_path, blocksiz, groups_count, inodes_per_group,
+           nthreads);
+
+    // һжڵӸĿ¼ʼбĿ¼
+    t0 = now_sec();
+    itab = calloc(groups_count, sizeof(ext2_inode *));
+    itab_count = calloc(groups_count, sizeof(int));
+    used_blocks = calloc(groups_count, blocksiz);
+    used_inodes = calloc(groups_count, blocksiz);
+    dir_count = calloc(groups_count, sizeof(int));
+    fsck_mark(used_inodes, 0); // Ŀ¼
+    dir_count[0] = 1;
+    dirs_found = 1;
+    fsck_push(0, 0);
+    pthread_barrier_init(&barrier, NULL, nthreads);
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&tids[i], NULL, fsck_worker, &barrier);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    pthread_barrier_destroy(&barrier);
+    t_check = now_sec() - t0;
+    if (fsck_errors && fix) // Ŀ¼дʱͷſڵ
+    {
+        printf("Ŀ¼дλͼֻ鲻޸\n");
+        fix = 0;
+    }
+
+    // ʵռ˶Բؽλͼ
+    expect = malloc(blocksiz);
+    for (g = 0; g < groups_count; g++)
+    {
+        used_b = used_i = 0;
+        memcpy(expect, used_blocks + g * (blocksiz / 4), blocksiz);
+        for (i = 0; i < blocksiz * 8; i++)
+            if (i >= group_blocks(g))
+                expect[i / 32] |= 0x80000000u >> (i % 32);
+            else if (expect[i / 32] & (0x80000000u >> (i % 32)))
+                used_b++;
+        repaired += fsck_bitmap(g, 0, expect, fix);
+        memcpy(expect, used_inodes + g * (blocksiz / 4), blocksiz);
+        for (i = 0; i < blocksiz * 8; i++)
+            if (i >= inodes_per_group)
+                expect[i / 32] |= 0x80000000u >> (i % 32);
+            else if (expect[i / 32] & (0x80000000u >> (i % 32)))
+                used_i++;
+        repaired += fsck_bitmap(g, 1, expect, fix);
+        if (gdt[g].bg_free_blocks_count != group_blocks(g) - used_b || gdt[g].bg_free_inodes_count != inodes_per_group - used_i ||
+            gdt[g].bg_used_dirs_count != dir_count[g])
+        {
+            printf(" %d ļ: п %d (ӦΪ %d), ڵ %d (ӦΪ %d), Ŀ¼ %d (ӦΪ %d)\n", g,
+                   gdt[g].bg_free_blocks_count, group_blocks(g) - used_b, gdt[g].bg_free_inodes_count, inodes_per_group - used_i,
+                   gdt[g].bg_used_dirs_count, dir_count[g]);
+            gdt[g].bg_free_blocks_count = group_blocks(g) - used_b;
+            gdt[g].bg_free_inodes_count = inodes_per_group - used_i;
+            gdt[g].bg_used_dirs_count = dir_count[g];
+            desc_changed = 1;
+        }
+        total_used += used_b;
+        total_blocks += group_blocks(g);
+    }
+    free(expect);
+    if (desc_changed && fix)
+        disk_pwrite(gdt, groups_count * sizeof(ext2_group_desc), 0);
+    if ((repaired || desc_changed) && fix)
+        disk_fsync();
+
+    if (fsck_errors > FSCK_MAX_REPORT)
+        printf("...  %d δг\n", fsck_errors - FSCK_MAX_REPORT);
+    printf("%s: %d ļ, %d Ŀ¼,  %ld/%ld , %d \n", fsck_path, files_found, dirs_found, total_used,
+           total_blocks, fsck_errors);
+    printf("ʱ %.3f :  %ld ڵ㣬%.0f ڵ/\n", t_check, inodes_scanned,
+           inodes_scanned / (t_check > 0 ? t_check : 1e-9));
+    if ((repaired || desc_changed) && fix)
+        printf("λͼؽ\n");
+    else if (repaired || desc_changed)
+        printf("λͼ (-n ģʽδ޸)\n");
+    umount_disk();
+    if (fsck_errors || ((repaired || desc_changed) && !fix))
+        return 4;
+    return repaired || desc_changed ? 1 : 0;
+}
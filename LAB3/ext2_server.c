@@ -0,0 +1,468 @@
+/*Ext2 ģļϵͳıطһ̶ռ MY_DISKͨ Unix ׽Ϊͻ˷
+  : gcc -O2 -pthread -o ext2_server ext2_server.c
+  ÷: ./ext2_server [-p ׽·] [-w ߳] [-j ] [-b С] [-s СMB]
+  ߳̽ӲУ̶Ĺ̸߳ȡһӣֱͻ˶Ͽ
+  ̹߳ͬһ黺桢ڵ㻺Ŀ¼棬ͬļϵֻڻ϶ݻ⡣
+  Э鰴нУͻ˷һȻظһ "״̬ ֵ"״̬ 0 ʾɹ1 ʾʧܣ
+    cd Ŀ¼            лǰĿ¼ (ÿԼĵǰĿ¼ʼΪĿ¼"/" صĿ¼)
+    create f|d       ļĿ¼
+    delete f|d       ɾļĿ¼
+    ls                   ֵΪĿ¼ÿһ "f|d  ֽ"
+    read ļ          ֵΪļСļ
+    write ļ ֽ   ֮ôֽڵݣ׷ӵļĩβֵΪдļС
+    sync                 ύ
+    quit                 Ͽ
+  ǰĿ¼ɾ󣬸ӵһʧܣǰĿ¼˻ظĿ¼
+   socat - UNIX-CONNECT:ext2.sock ֹ*/
+#define EXT2_NO_MAIN
+#include "Ext2.c"
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVER_SOCKET "ext2.sock" // Ĭϵ׽·
+#define SERVER_WORKERS 4          // ĬϵĹ߳
+#define SERVER_QUEUE 64           // ȴ̵߳
+#define SERVER_LINE 256           // е󳤶
+#define SERVER_BUF 4096           // ÿӵĽջС
+
+// һͻ
+typedef struct client {
+    int fd;                  // ׽
+    int cwd;                 // ǰĿ¼ڵ
+    char buf[SERVER_BUF];    // ջ
+    int len;                 // еֽ
+    int pos;                 // һδֽ
+} client;
+
+int conn_queue[SERVER_QUEUE];            // ѽܡȴ̴߳
+int queue_head = 0;                      // λ
+int queue_len = 0;                       // е
+pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queue_nonempty = PTHREAD_COND_INITIALIZER;
+pthread_cond_t queue_nonfull = PTHREAD_COND_INITIALIZER;
+pthread_rwlock_t txn_lock = PTHREAD_RWLOCK_INITIALIZER; // ִڼжύʱдһύִеһ
+volatile sig_atomic_t server_stop = 0;   // յ SIGINT  SIGTERM  1
+
+void on_signal(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+/*Ӷȡһֽڣͻ˶Ͽʱ -1*/
+int client_getc(client *c)
+{
+    if (c->pos == c->len)
+    {
+        c->len = recv(c->fd, c->buf, SERVER_BUF, 0);
+        c->pos = 0;
+        if (c->len <= 0)
+        {
+            c->len = 0;
+            return -1;
+        }
+    }
+    return (unsigned char)c->buf[c->pos++];
+}
+
+/*ȡһ (ȥβ \r\n)ֶͻ˶Ͽʱ -1*/
+int client_readline(client *c, char *line, int max)
+{
+    int ch, n = 0;
+    while ((ch = client_getc(c)) != -1 && ch != '\n')
+        if (n < max - 1)
+            line[n++] = ch;
+    if (ch == -1 && n == 0)
+        return -1;
+    if (n > 0 && line[n - 1] == '\r')
+        n--;
+    line[n] = 0;
+    return n;
+}
+
+/*ȡ len ֽݣͻǰϿʱ 1*/
+int client_read(client *c, char *buf, long len)
+{
+    long done = 0;
+    int n, ch;
+    while (done < len)
+    {
+        if (c->pos < c->len) // ȡʣ
+        {
+            n = c->len - c->pos < len - done ? c->len - c->pos : (int)(len - done);
+            memcpy(buf + done, c->buf + c->pos, n);
+            c->pos += n;
+            done += n;
+        }
+        else if ((ch = client_getc(c)) == -1)
+            return 1;
+        else
+            buf[done++] = ch;
+    }
+    return 0;
+}
+
+/*ȫݣͻ˶Ͽʱ*/
+void client_send(client *c, const char *buf, long len)
+{
+    long done = 0, n;
+    while (done < len && (n = send(c->fd, buf + done, len - done, MSG_NOSIGNAL)) > 0)
+        done += n;
+}
+
+/*ظһ "״̬ ֵ"*/
+void client_reply(client *c, int status, long long value)
+{
+    char line[64];
+    client_send(c, line, sprintf(line, "%d %lld\n", status, value));
+}
+
+/*һ (force Ϊ 1 ʱύ)־ʱ journal_end һύ
+  ֻύʱżдִ߳еƽʱ*/
+void server_sync(int force)
+{
+    time_t now;
+    int due;
+    if (!journal_active && !force) // ־ʱдûԭҪ
+    {
+        pthread_rwlock_rdlock(&txn_lock);
+        bsync();
+        pthread_rwlock_unlock(&txn_lock);
+        return;
+    }
+    time(&now);
+    cache_lock();
+    due = force || ++journal_pending >= journal_batch || now - journal_last_commit >= JOURNAL_INTERVAL;
+    cache_unlock();
+    if (!due)
+        return;
+    pthread_rwlock_wrlock(&txn_lock);
+    if (force)
+        disk_flush();
+    else
+        journal_commit();
+    pthread_rwlock_unlock(&txn_lock);
+}
+
+/* ino Ŀ¼Ӷ (write Ϊ 0) д curѱɾĿ¼ʱ 1*/
+int dir_lock(int ino, ext2_inode *cur, int write)
+{
+    int live;
+    inode_lock(ino, write); // Delete бɾĿ¼дõĿ¼ҪôáҪôѾͷ
+    inode_read(ino, cur);
+    alloc_lock();
+    live = bitmap_test(&inode_bitmap, ino); // ͷŵڵ㲻дأֻܴλͼж
+    alloc_unlock();
+    if (live && cur->i_mode == 2 && cur->i_dtime == 0) // Delete ժĿ¼ȼɾʱ䣬ɾе
+        return 0;
+    inode_unlock(ino);
+    return 1;
+}
+
+/*ǰĿ¼Ӷ (write Ϊ 0) д curֻ¼ǰĿ¼ڵţ
+  ѱɾʱѵǰĿ¼˻ظĿ¼ 1*/
+int cwd_lock(client *c, ext2_inode *cur, int write)
+{
+    if (dir_lock(c->cwd, cur, write) == 0)
+        return 0;
+    c->cwd = 0;
+    return 1;
+}
+
+/*лǰĿ¼ɹ 0*/
+int server_cd(client *c, char *name)
+{
+    ext2_inode cur;
+    ext2_dir_entry entry;
+    int ino;
+    if (!strcmp(name, "/"))
+    {
+        c->cwd = 0;
+        return 0;
+    }
+    if (cwd_lock(c, &cur, 0) != 0)
+        return 1;
+    ino = lookup(&cur, name, 2, &entry) >= 0 ? entry.inode : -1;
+    inode_unlock(c->cwd); // ȷſǰĿ¼Ŀ꣺"cd .." ʱܳĿ¼ȥĿ¼
+    if (ino < 0 || dir_lock(ino, &cur, 0) != 0) // μ֮Ŀѱɾ
+        return 1;
+    inode_unlock(ino);
+    c->cwd = ino;
+    return 0;
+}
+
+/*ڵǰĿ¼д (create Ϊ 1) ɾ (Ϊ 0) ļĿ¼ɹ 0*/
+int server_change(client *c, int create, char *type, char *name)
+{
+    ext2_inode cur;
+    int t = !strcmp(type, "f") ? 1 : !strcmp(type, "d") ? 2 : 0, ret;
+    if (t == 0 || name[0] == 0 || strlen(name) > EXT2_NAME_LEN)
+        return 1;
+    if (cwd_lock(c, &cur, 1) != 0) // סĿ¼ٶ֤ Create/Delete µĿ¼ڵ
+        return 1;
+    ret = create ? Create(t, &cur, name) : Delete(t, &cur, name);
+    inode_unlock(c->cwd);
+    return ret;
+}
+
+/*гǰĿ¼*/
+void server_ls(client *c)
+{
+    ext2_inode cur, node;
+    ext2_dir_entry buf, *e;
+    char *out;
+    int i, n, len = 0;
+    if (cwd_lock(c, &cur, 0) != 0)
+    {
+        client_reply(c, 1, 0);
+        return;
+    }
+    n = cur.i_size / dirsiz;
+    out = malloc((long)n * (EXT2_NAME_LEN + 16) + 1);
+    for (i = 0; i < n; i++)
+    {
+        e = dir_entry_get(i * dirsiz, &cur, &buf);
+        inode_read(e->inode, &node);
+        len += sprintf(out + len, "%c %s %d\n", e->file_type == 2 ? 'd' : 'f', e->name, node.i_size);
+    }
+    inode_unlock(c->cwd);
+    client_reply(c, 0, n);
+    client_send(c, out, len);
+    free(out);
+}
+
+/*ǰĿ¼еļ name*/
+void server_read(client *c, char *name)
+{
+    ext2_inode cur, node;
+    ext2_dir_entry entry;
+    char *data;
+    int i, n;
+    if (cwd_lock(c, &cur, 0) != 0)
+    {
+        client_reply(c, 1, 0);
+        return;
+    }
+    if (lookup(&cur, name, 1, &entry) < 0)
+    {
+        inode_unlock(c->cwd);
+        client_reply(c, 1, 0);
+        return;
+    }
+    inode_lock(entry.inode, 0);
+    inode_read(entry.inode, &node);
+    data = malloc(node.i_size + 1);
+    for (i = 0; i < node.i_size; i += n)
+        if ((n = read_file(&node, entry.inode, i, data + i, READ_CHUNK)) <= 0)
+            break;
+    inode_unlock(entry.inode);
+    inode_unlock(c->cwd);
+    client_reply(c, 0, i);
+    client_send(c, data, i);
+    free(data);
+}
+
+/* data е len ֽ׷ӵǰĿ¼еļ nameɹ 0  size иµļС*/
+int server_write(client *c, char *name, char *data, long len, long long *size)
+{
+    ext2_inode cur, node;
+    ext2_dir_entry entry;
+    int ret = 1;
+    *size = 0;
+    if (cwd_lock(c, &cur, 0) != 0)
+        return 1;
+    if (lookup(&cur, name, 1, &entry) < 0)
+    {
+        inode_unlock(c->cwd);
+        return 1;
+    }
+    inode_lock(entry.inode, 1);
+    inode_read(entry.inode, &node);
+    if (node.i_size + len <= 0x7fffffff && append_file(&node, entry.inode, data, (int)len) == 0)
+    {
+        time(&node.i_mtime);
+        node.i_atime = node.i_mtime;
+        ret = 0;
+    }
+    inode_write(entry.inode, &node); // 䵽һռ䲻ʱҲҪѷĿ
+    *size = node.i_size;
+    inode_unlock(entry.inode);
+    inode_unlock(c->cwd);
+    return ret;
+}
+
+/*һϵȫ*/
+void serve(client *c)
+{
+    char line[SERVER_LINE], cmd[SERVER_LINE], a1[SERVER_LINE], a2[SERVER_LINE], *data;
+    long long size;
+    long len;
+    int n, ret;
+    while (client_readline(c, line, SERVER_LINE) >= 0)
+    {
+        a1[0] = a2[0] = 0;
+        if ((n = sscanf(line, "%s %s %s", cmd, a1, a2)) <= 0)
+            continue;
+        if (!strcmp(cmd, "quit"))
+            break;
+        if (!strcmp(cmd, "write")) // ڼ֮ǰȫ£ڳʱȴ
+        {
+            len = atol(a2);
+            if (n < 3 || len < 0 || len > 0x7fffffff || (data = malloc(len + 1)) == NULL)
+            {
+                client_reply(c, 1, 0);
+                break; // ޷ݣϿ
+            }
+            if (client_read(c, data, len))
+            {
+                free(data);
+                break;
+            }
+            pthread_rwlock_rdlock(&txn_lock);
+            ret = server_write(c, a1, data, len, &size);
+            pthread_rwlock_unlock(&txn_lock);
+            free(data);
+            server_sync(0); // Żظͻյظʱ޸Ѿ־򻺴
+            client_reply(c, ret, size);
+            continue;
+        }
+        if (!strcmp(cmd, "sync"))
+        {
+            server_sync(1);
+            client_reply(c, 0, 0);
+            continue;
+        }
+        pthread_rwlock_rdlock(&txn_lock);
+        if (!strcmp(cmd, "ls")) // ls  read лظ
+            server_ls(c);
+        else if (!strcmp(cmd, "read") && n >= 2)
+            server_read(c, a1);
+        else
+        {
+            if (!strcmp(cmd, "cd") && n >= 2)
+                ret = server_cd(c, a1);
+            else if ((!strcmp(cmd, "create") || !strcmp(cmd, "delete")) && n >= 3)
+                ret = server_change(c, cmd[0] == 'c', a1, a2);
+            else
+                ret = 1; // Ч
+            client_reply(c, ret, 0);
+        }
+        pthread_rwlock_unlock(&txn_lock);
+        if (!strcmp(cmd, "create") || !strcmp(cmd, "delete"))
+            server_sync(0);
+    }
+}
+
+/*̣߳ӶȡӲ*/
+void *worker(void *arg)
+{
+    client *c = malloc(sizeof(client));
+    (void)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&queue_mutex);
+        while (queue_len == 0)
+            pthread_cond_wait(&queue_nonempty, &queue_mutex);
+        c->fd = conn_queue[queue_head];
+        queue_head = (queue_head + 1) % SERVER_QUEUE;
+        queue_len--;
+        pthread_cond_signal(&queue_nonfull);
+        pthread_mutex_unlock(&queue_mutex);
+
+        c->cwd = 0; // ӸĿ¼ʼ
+        c->len = c->pos = 0;
+        serve(c);
+        close(c->fd);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    ext2_inode root;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    sigset_t mask;
+    pthread_t tid;
+    char *path = SERVER_SOCKET;
+    int nworkers = SERVER_WORKERS, i, lfd, fd;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            path = argv[++i];
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+        {
+            nworkers = atoi(argv[++i]);
+            if (nworkers > ILOCK_SLOTS / 3) // ÿ߳ͬʱڵ
+                nworkers = ILOCK_SLOTS / 3;
+        }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            journal_batch = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            format_blocksiz = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            format_volume = atoll(argv[++i]) << 20;
+        else
+        {
+            printf("÷: %s [-p ׽·] [-w ߳] [-j ] [-b С] [-s СMB]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    batch_mode = 1; // ̲ʱֱӸʽʾȷ
+    if (initfs(&root) != 0)
+        return 1;
+
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path); // ϴ쳣˳µ׽ļ
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, SERVER_QUEUE) != 0)
+    {
+        perror(path);
+        umount_disk();
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal; //  SA_RESTARTaccept źŴϺ˳ѭ
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL); // ̼̳֣߳źֻ͵߳
+
+    for (i = 0; i < nworkers; i++)
+    {
+        pthread_create(&tid, NULL, worker, NULL);
+        pthread_detach(tid);
+    }
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    printf(": %s, %d ߳\n", path, nworkers);
+    fflush(stdout);
+
+    while (!server_stop)
+    {
+        if ((fd = accept(lfd, NULL, NULL)) < 0)
+            continue;
+        pthread_mutex_lock(&queue_mutex);
+        while (queue_len == SERVER_QUEUE)
+            pthread_cond_wait(&queue_nonfull, &queue_mutex);
+        conn_queue[(queue_head + queue_len) % SERVER_QUEUE] = fd;
+        queue_len++;
+        pthread_cond_signal(&queue_nonempty);
+        pthread_mutex_unlock(&queue_mutex);
+    }
+
+    close(lfd);
+    unlink(path);
+    pthread_rwlock_wrlock(&txn_lock); // ȴִе֮ٿʼµ
+    umount_disk();
+    printf("˳\n");
+    return 0;
+}